@@ -0,0 +1,187 @@
+/*
+ * EpochReader.cpp
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "EpochReader.h"
+
+static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+static inline const unsigned char* pageDown(const unsigned char* p)
+{
+	return (const unsigned char*) ((ADDRINT) p & ~(ADDRINT) (pageSize - 1));
+}
+
+// like atoi on the field [p, end)
+static UINT32 parseField(const unsigned char* p, const unsigned char* end)
+{
+	while (p < end && isspace(*p))
+	{
+		p++;
+	}
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		p++;
+	}
+
+	UINT32 value = 0;
+	for (; p < end && isdigit(*p); p++)
+	{
+		value = value * 10 + (*p - '0');
+	}
+	return negative ? -value : value;
+}
+
+EpochReader::EpochReader() :
+		begin(NULL), end(NULL), text(NULL), released(NULL), binary(NULL),
+		slot(NON_THREAD_VECTOR_CLOCK)
+{}
+
+EpochReader::~EpochReader()
+{
+	delete binary;
+	if (begin)
+	{
+		munmap((void*) begin, end - begin);
+	}
+}
+
+bool EpochReader::open(const char* fileName, int slot)
+{
+	this->slot = slot;
+
+	int fd = ::open(fileName, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat status;
+	if (fstat(fd, &status))
+	{
+		close(fd);
+		return false;
+	}
+	if (status.st_size == 0)
+	{
+		// an empty log has no clocks
+		close(fd);
+		return true;
+	}
+
+	void* memory = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+	{
+		return false;
+	}
+	madvise(memory, status.st_size, MADV_SEQUENTIAL);
+
+	begin = (const unsigned char*) memory;
+	end = begin + status.st_size;
+	text = begin;
+	released = begin;
+
+	if (isBinaryEpochLog(begin, end))
+	{
+		binary = new EpochLogReader(begin, end);
+		return binary->isValid();
+	}
+	return true;
+}
+
+bool EpochReader::next()
+{
+	if (!begin)
+	{
+		return false;
+	}
+
+	bool found;
+	if (binary)
+	{
+		found = binary->next(components);
+		release(binary->getPosition());
+	}
+	else
+	{
+		found = nextText();
+		release(text);
+	}
+	return found;
+}
+
+void EpochReader::get(VectorClock& clock) const
+{
+	clock.clear();
+	clock.threadId = slot;
+	for (size_t i = 0; i < components.size(); i++)
+	{
+		if (components[i])
+		{
+			clock.set(i, components[i]);
+		}
+	}
+}
+
+bool EpochReader::atEnd() const
+{
+	if (!begin)
+	{
+		return true;
+	}
+	return binary ? binary->atEnd() : text >= end;
+}
+
+/*
+ * The comma separated components of the next line, read like the istream
+ * constructor of VectorClock did
+ */
+bool EpochReader::nextText()
+{
+	if (text >= end)
+	{
+		return false;
+	}
+
+	const unsigned char* lineEnd =
+	    (const unsigned char*) memchr(text, '\n', end - text);
+	if (!lineEnd)
+	{
+		lineEnd = end;
+	}
+
+	components.clear();
+	for (const unsigned char* field = text; field < lineEnd;)
+	{
+		const unsigned char* fieldEnd =
+		    (const unsigned char*) memchr(field, ',', lineEnd - field);
+		if (!fieldEnd)
+		{
+			fieldEnd = lineEnd;
+		}
+		components.push_back(parseField(field, fieldEnd));
+		field = fieldEnd + 1;
+	}
+
+	text = lineEnd < end ? lineEnd + 1 : end;
+	return true;
+}
+
+// the pages before position are replayed, drop them once there are enough
+void EpochReader::release(const unsigned char* position)
+{
+	const unsigned char* until = pageDown(position);
+	if (until - released >= EPOCH_RELEASE_SIZE)
+	{
+		madvise((void*) released, until - released, MADV_DONTNEED);
+		released = until;
+	}
+}
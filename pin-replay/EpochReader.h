@@ -0,0 +1,59 @@
+/*
+ * EpochReader.h
+ *
+ * Reads the epoch log of a recorded thread (thread_epochs.<tid>) one clock at
+ * a time, as the replay goes through them. The file is mapped rather than
+ * read, so starting a thread doesn't depend on the size of its log, and the
+ * pages already replayed are given back as it goes. Both the text logs and
+ * the binary ones (-epochFormat binary of the recording) are read.
+ *
+ * Only the thread the log belongs to uses a reader, it takes no lock.
+ */
+
+#ifndef EPOCHREADER_H_
+#define EPOCHREADER_H_
+
+#include "pin.H"
+
+#include <stddef.h>
+#include <vector>
+
+#include "../pin/VectorClock.h"
+#include "../pin/EpochLogFormat.h"
+
+// replayed bytes of a log given back at once
+#define EPOCH_RELEASE_SIZE (16 << 20)
+
+class EpochReader
+{
+public:
+	EpochReader();
+	~EpochReader();
+
+	// maps the log, the clocks read get slot as their thread
+	bool open(const char* fileName, int slot);
+
+	// moves to the next clock of the log, false at its end
+	bool next();
+
+	// the clock next moved to
+	void get(VectorClock& clock) const;
+
+	// all of the log was read, false if it ends in a truncated epoch
+	bool atEnd() const;
+
+private:
+	bool nextText();
+	void release(const unsigned char* position);
+
+	const unsigned char* begin;
+	const unsigned char* end;
+	const unsigned char* text; // next line of a text log
+	const unsigned char* released; // pages before it were given back
+	EpochLogReader* binary;
+	int slot;
+
+	std::vector<uint32_t> components;
+};
+
+#endif /* EPOCHREADER_H_ */
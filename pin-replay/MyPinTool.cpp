@@ -5,6 +5,7 @@
 #include <vector>
 #include <deque>
 #include <map>
+#include <set>
 #include <algorithm>
 #include "pin.H"
 #include <semaphore.h>
@@ -21,7 +22,9 @@
 
 #include "../pin/RecordNReplay.h"
 #include "../pin/VectorClock.h"
+#include "../pin/VectorClockKernels.h"
 #include "../pin/SigraceModules.h"
+#include "EpochReader.h"
 /* ### MY ADDITIONS ################################################ */
 
 /* KNOB parameters */
@@ -29,7 +32,18 @@ KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "output",
                             "specify output file name");
 
 KNOB<string> KnobMode(KNOB_MODE_WRITEONCE, "pintool", "mode", "replay",
-                      "specify mode");
+                      "replay: all the recorded order, races: only the order "
+                      "of the racing epochs (thread start, create and join "
+                      "only)");
+
+KNOB<string> KnobRaceFile(KNOB_MODE_WRITEONCE, "pintool", "raceFile",
+                          "../pin/race_info.txt",
+                          "specify the races of the recording, for -mode races");
+
+KNOB<UINT32> KnobRaceWaitTimeout(KNOB_MODE_WRITEONCE, "pintool",
+                                 "raceWaitTimeout", "1000",
+                                 "ms a racing epoch waits for its order before "
+                                 "going on anyway, for -mode races");
 
 KNOB<string> KnobCreateFile(KNOB_MODE_WRITEONCE, "pintool", "createFile",
                             "../pin/create.txt",
@@ -39,6 +53,10 @@ KNOB<string> KnobEpochFile(KNOB_MODE_WRITEONCE, "pintool", "epochFile",
                            "../pin/thread_epochs.",
                            "specify create file to order the thread creations");
 
+KNOB<string> KnobClockKernel(KNOB_MODE_WRITEONCE, "pintool", "clockKernel",
+                             "auto",
+                             "vector clock kernels: auto, scalar, sse41 or avx2");
+
 INT32 Usage()
 {
 	cerr << "This tool replays a multithread program." << endl;
@@ -66,9 +84,6 @@ INT32 Usage()
 /* ### MY ADDITIONS ################################################ */
 static THREADID globalCreatedThreadId = 1;
 
-typedef deque<VectorClock> EpochList;
-typedef EpochList::iterator EpochListIterator;
-
 typedef map<THREADID, VectorClock> ChildVCMap;
 typedef ChildVCMap::iterator ChildVCMapItr;
 
@@ -76,11 +91,12 @@ class ThreadLocalStorage
 {
 public:
 	FILE* out;                        // ?????
-	EpochList epochList;              // Epoch history coming from normal execution
+	EpochReader epochs;               // Epoch history coming from normal execution
 	VectorClock currentVC;            // Current vector clock of the thread
 	VectorClock TRT;                  // Next vector clock of the thread
 	//	deque<VectorClock> createVCList;  // List of vc taken at thread creation times
 	THREADID tid;
+	PIN_SEMAPHORE wakeUp;             // set when the thread may go on
 
 	ChildVCMap childVCMap;
 
@@ -88,6 +104,7 @@ public:
 	{
 		this->tid = tid;
 		out = NULL;
+		PIN_SemaphoreInit(&wakeUp);
 	}
 
 	~ThreadLocalStorage()
@@ -97,6 +114,7 @@ public:
 		{
 			fclose(out);
 		}
+		PIN_SemaphoreFini(&wakeUp);
 	}
 };
 
@@ -112,34 +130,35 @@ ThreadLocalStorage* getTLS(THREADID tid)
  * Advances the TRT and returns true if TRT is successfully advanced
  */
 
-PIN_LOCK epochListLock;
-
 inline static
 bool advanceTRT(ThreadLocalStorage* tls)
 {
 	assert(tls);
 
-	GetLock(&epochListLock, tls->tid);
-	if(! tls->epochList.empty())
+	// only the thread itself reads its epochs
+	if (tls->epochs.next())
 	{
 		tls->currentVC = tls->TRT;
-
-		EpochListIterator itr = tls->epochList.begin();
-		tls->TRT = *itr;
-
-		tls->epochList.pop_front();
-
-		ReleaseLock(&epochListLock);
+		tls->epochs.get(tls->TRT);
 		return true;
 	}
 
-	ReleaseLock(&epochListLock);
 	return false;
 }
 
 ThreadCreateOrder threadCreateOrder;
 ThreadCreateOrderItr currentCreateOrder;
 
+// vector clock slots of the recorded threads, from create.txt
+map<THREADID, UINT32> threadSlotMap;
+
+inline static
+UINT32 getSlot(THREADID tid)
+{
+	map<THREADID, UINT32>::iterator itr = threadSlotMap.find(tid);
+	return itr == threadSlotMap.end() ? tid : itr->second;
+}
+
 ThreadIdMap threadIdMap;
 
 // Global Re-execution Timestamp
@@ -147,29 +166,173 @@ VectorClock GRT;
 PIN_LOCK GRTLock;
 
 /*
- * Wait for the global timestamp to pass and then update it
+ * With -mode races only the epochs in a race of race_info.txt wait for GRT,
+ * the others run as they come. Like -mode replay, this tool only waits at
+ * thread start, pthread_create and pthread_join, so those are the only
+ * epoch boundaries ordered: a race whose sides are split by mutex,
+ * condition or barrier operations isn't. A racing epoch waits for
+ * everything ordered before it in the recording. Since the free epochs may
+ * run in another order than recorded, such a wait gives up after
+ * -raceWaitTimeout rather than deadlock, with a warning.
  */
-const UINT32 SLEEP_TIME = 10;
+bool racesOnly = false;
+set<pair<UINT32, UINT32> > racingEpochs; // slot, clock
 
-void static
-updateGRTLoop(THREADID tid, ThreadLocalStorage* tls)
+// waits of -mode races, guarded by GRTLock
+UINT64 enforcedWaits = 0;
+UINT64 skippedWaits = 0;
+UINT64 timedOutWaits = 0;
+
+// "tid slot clock other-tid other-slot other-clock" for each race
+static void loadRacingEpochs(const char* fileName)
 {
-	while (true)
+	FILE* raceFile = fopen(fileName, "r");
+	if (!raceFile)
+	{
+		fprintf(stderr, "Couldn't read the race file %s\n", fileName);
+		exit(1);
+	}
+
+	THREADID tid, otherTid;
+	UINT32 slot, clock, otherSlot, otherClock;
+	char line[128];
+	while (fgets(line, sizeof(line), raceFile))
+	{
+		if (sscanf(line, "%u %u %u %u %u %u", &tid, &slot, &clock, &otherTid,
+		           &otherSlot, &otherClock) != 6)
+		{
+			fprintf(stderr, "error occured while reading from race file %s\n",
+			        fileName);
+			exit(1);
+		}
+		racingEpochs.insert(make_pair(slot, clock));
+		racingEpochs.insert(make_pair(otherSlot, otherClock));
+	}
+	fclose(raceFile);
+}
+
+/*
+ * A thread whose TRT isn't below GRT yet sleeps on its wakeUp semaphore,
+ * filed under a component of its TRT that GRT hasn't reached. GRT only
+ * changes in updateGRT, one component at a time, which goes through the
+ * threads filed under that component: the ones that may go now are woken,
+ * the others filed under the next component they wait for. Guarded by
+ * GRTLock.
+ */
+typedef map<UINT32, vector<ThreadLocalStorage*> > GRTWaiterMap;
+GRTWaiterMap grtWaiters;
+
+// a component of TRT (but its own) still above GRT, -1 if TRT is below it
+static int blockingComponent(const VectorClock& TRT)
+{
+	for (UINT32 i = 0; i < TRT.getSize(); i++)
+	{
+		if ((int) i != TRT.threadId && TRT.get(i) > GRT.get(i))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// holding GRTLock, the thread timed out and is still filed somewhere
+static void removeGRTWaiter(ThreadLocalStorage* tls)
+{
+	for (GRTWaiterMap::iterator itr = grtWaiters.begin();
+	        itr != grtWaiters.end(); itr++)
 	{
+		vector<ThreadLocalStorage*>::iterator waiter =
+		    find(itr->second.begin(), itr->second.end(), tls);
+		if (waiter != itr->second.end())
+		{
+			itr->second.erase(waiter);
+			return;
+		}
+	}
+}
+
+// holding GRTLock, it's held again when TRT is below GRT
+static void waitForGRT(THREADID tid, ThreadLocalStorage* tls)
+{
+	if (racesOnly)
+	{
+		UINT32 slot = tls->TRT.threadId;
+		if (!racingEpochs.count(make_pair(slot, tls->TRT.get(slot))))
+		{
+			skippedWaits++;
+			return;
+		}
+		enforcedWaits++;
+	}
+
+	int component;
+	while ((component = blockingComponent(tls->TRT)) >= 0)
+	{
+		PIN_SemaphoreClear(&tls->wakeUp);
+		grtWaiters[component].push_back(tls);
+		ReleaseLock(&GRTLock);
+
+		if (!racesOnly)
+		{
+			PIN_SemaphoreWait(&tls->wakeUp);
+			GetLock(&GRTLock, tid + 1);
+			continue;
+		}
+
+		PIN_SemaphoreTimedWait(&tls->wakeUp, KnobRaceWaitTimeout.Value());
 		GetLock(&GRTLock, tid + 1);
+		// updateGRT sets it under GRTLock, so it's either set or still filed
+		if (!PIN_SemaphoreIsSet(&tls->wakeUp))
+		{
+			removeGRTWaiter(tls);
+			timedOutWaits++;
+			fprintf(stderr, "Racing epoch %u of slot %u (thread %u) gave up "
+			        "waiting for slot %d after %u ms, the race may run out of "
+			        "order\n", tls->TRT.get(tls->TRT.threadId),
+			        tls->TRT.threadId, tid, component,
+			        KnobRaceWaitTimeout.Value());
+			return;
+		}
+	}
+}
+
+// holding GRTLock, GRT takes the thread's own component of TRT
+static void updateGRT(const VectorClock& TRT)
+{
+	GRT.updateGRT(TRT);
+
+	GRTWaiterMap::iterator itr = grtWaiters.find(TRT.threadId);
+	if (itr == grtWaiters.end())
+	{
+		return;
+	}
+	vector<ThreadLocalStorage*> waiters;
+	waiters.swap(itr->second);
+	grtWaiters.erase(itr);
 
-		if (tls->TRT.lessThanGRT(GRT))
+	for (size_t i = 0; i < waiters.size(); i++)
+	{
+		int component = blockingComponent(waiters[i]->TRT);
+		if (component < 0)
 		{
-			break;
+			PIN_SemaphoreSet(&waiters[i]->wakeUp);
 		}
 		else
 		{
-			ReleaseLock(&GRTLock);
-			PIN_Sleep(SLEEP_TIME);
+			grtWaiters[component].push_back(waiters[i]);
 		}
 	}
+}
 
-	GRT.updateGRT(tls->TRT);
+/*
+ * Wait for the global timestamp to pass and then update it
+ */
+void static
+updateGRTLoop(THREADID tid, ThreadLocalStorage* tls)
+{
+	GetLock(&GRTLock, tid + 1);
+	waitForGRT(tid, tls);
+	updateGRT(tls->TRT);
 	ReleaseLock(&GRTLock);
 }
 
@@ -190,7 +353,10 @@ PIN_LOCK threadStartLock;
 PIN_LOCK index_lock;
 PIN_LOCK atomic_create;
 
-VectorClock current_vc[MAX_THREAD_COUNT];
+// the threads waiting for their turn to create, guarded by atomic_create
+map<THREADID, ThreadLocalStorage*> createWaiters;
+
+map<UINT32, VectorClock> current_vc;
 UINT32 global_id = 0;
 UINT32 global_index = 0;
 
@@ -349,52 +515,38 @@ VOID BeforeCreate(THREADID tid, pthread_t *__restrict newthread,
 	if (!enable_tool)
 		return;
 
-	//this is slighly different than others
-	pair<UINT32, SIZE> temp_pair;
-
-#ifdef ENABLE_GRT_CHECK
-
 	ThreadLocalStorage* tls = getTLS(tid);
 	assert(tls);
-#endif
 
+	// wait for the turn of the thread to create, AfterCreate passes it on
+	GetLock(&atomic_create, tid + 1);
 	while (true)
 	{
-		GetLock(&atomic_create, tid + 1);
-		GetLock(&GRTLock, tid + 1);
-
 		assert(currentCreateOrder != threadCreateOrder.end());
-		CreateInfo ci = *currentCreateOrder;
-
-#ifdef ENABLE_GRT_CHECK
-
-#ifdef ENABLE_REEXECUTE_DEBUG
-
-		cout << "Create\nGRT: " << GRT << "TRT: " << tls->TRT << endl;
-#endif
-
-		if (tid == ci.parent && tls->TRT.lessThanGRT(GRT))
+		if (tid == currentCreateOrder->parent)
 		{
 			break;
 		}
-#else
+		PIN_SemaphoreClear(&tls->wakeUp);
+		createWaiters[tid] = tls;
+		ReleaseLock(&atomic_create);
 
-		if (tid == ci.parent)
-		{
-			break;
-		}
-#endif
-		else
-		{
-			ReleaseLock(&GRTLock);
-			ReleaseLock(&atomic_create);
-			PIN_Sleep(SLEEP_TIME);
-		}
+		PIN_SemaphoreWait(&tls->wakeUp);
+		GetLock(&atomic_create, tid + 1);
 	}
 
+	// the other creators wait for their turn, atomic_create stays held
+	GetLock(&GRTLock, tid + 1);
+
 #ifdef ENABLE_GRT_CHECK
 
-	GRT.updateGRT(tls->TRT);
+#ifdef ENABLE_REEXECUTE_DEBUG
+
+	cout << "Create\nGRT: " << GRT << "TRT: " << tls->TRT << endl;
+#endif
+
+	waitForGRT(tid, tls);
+	updateGRT(tls->TRT);
 #ifdef ENABLE_REEXECUTE_DEBUG
 
 	cout << "GRT after create: \n" << GRT << endl;
@@ -412,6 +564,18 @@ VOID AfterCreate(THREADID tid, int rc)
 {
 	globalCreatedThreadId++;
 	currentCreateOrder++;
+
+	// wake the next creator if it's already waiting
+	if (currentCreateOrder != threadCreateOrder.end())
+	{
+		map<THREADID, ThreadLocalStorage*>::iterator itr =
+		    createWaiters.find(currentCreateOrder->parent);
+		if (itr != createWaiters.end())
+		{
+			PIN_SemaphoreSet(&itr->second->wakeUp);
+			createWaiters.erase(itr);
+		}
+	}
 	ReleaseLock(&atomic_create);
 }
 
@@ -719,19 +883,28 @@ VOID BeforeMain(THREADID tid, int argc, char ** argv)
 	FILE* createFile = fopen(KnobCreateFile.Value().c_str(), "r");
 
 	THREADID created, parent;
+	UINT32 slot;
 	int readCount;
+	char line[64];
 
-	while (!feof(createFile))
+	// "tid parent slot", files without the slot used the tid as the slot
+	while (fgets(line, sizeof(line), createFile))
 	{
-		readCount = fscanf(createFile, "%d %d\n", &created, &parent);
-		if (readCount != 2)
+		readCount = sscanf(line, "%d %d %d", &created, &parent, &slot);
+		if (readCount == 2)
+		{
+			slot = created;
+		}
+		else if (readCount != 3)
 		{
 			fprintf(stderr, "error occured while reading from create file %s\n",
 			        KnobCreateFile.Value().c_str());
 			exit(1);
 		}
-		threadCreateOrder.push_back(CreateInfo(created, parent));
+		threadCreateOrder.push_back(CreateInfo(created, parent, slot));
+		threadSlotMap[created] = slot;
 	}
+	fclose(createFile);
 	currentCreateOrder  = threadCreateOrder.begin();
 	/* MY ADDITIONS */
 
@@ -747,28 +920,13 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
 {
 	ThreadLocalStorage* tls = new ThreadLocalStorage(tid);
 
-	// create the stream to read the epochs
-	char epochFileName[30];
-	sprintf(epochFileName, "%s%d", KnobEpochFile.Value().c_str(), tid);
-
-	ifstream infile(epochFileName);
-
-	GetLock(&epochListLock, tid + 1);
-	// read epochs into memory
-	while (infile)
+	// map the epochs, they are decoded as the thread goes
+	string epochFileName = KnobEpochFile.Value() + decstr(tid);
+	if (!tls->epochs.open(epochFileName.c_str(), getSlot(tid)))
 	{
-		string s;
-		if (!getline( infile, s ))
-		{
-			break;
-		}
-
-		istringstream ss( s );
-		vector <int> record;
-
-		tls->epochList.push_back(VectorClock(ss, tid));
+		fprintf(stderr, "Couldn't read the epoch log %s\n",
+		        epochFileName.c_str());
 	}
-	ReleaseLock(&epochListLock);
 
 	// load the first TRT
 	bool emptyEpochListCheck = advanceTRT(tls);
@@ -806,7 +964,7 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
 		ChildVCMapItr itr = parentTLS->childVCMap.find(tid);
 		assert(itr != parentTLS->childVCMap.end());
 
-		VectorClock calculatedVC(itr->second, tid);
+		VectorClock calculatedVC(itr->second, getSlot(tid));
 
 		// compare it with TRT
 		assert(tls->currentVC == calculatedVC ||
@@ -830,15 +988,25 @@ VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
 	// create the last TRT
 	tls->TRT.advance();
 
-	GetLock(&epochListLock, tid+1);
-	assert(tls->epochList.empty());
-	ReleaseLock(&epochListLock);
+	assert(tls->epochs.atEnd());
 
 	GetLock(&GRTLock, tid+1);
-	GRT.updateGRT(tls->TRT);
+	updateGRT(tls->TRT);
 	ReleaseLock(&GRTLock);
 }
 
+VOID Fini(INT32 code, VOID *v)
+{
+	if (racesOnly)
+	{
+		fprintf(stderr, "racing epochs: %lu, waits enforced: %llu, skipped: %llu, "
+		        "timed out: %llu\n", (unsigned long) racingEpochs.size(),
+		        (unsigned long long) enforcedWaits,
+		        (unsigned long long) skippedWaits,
+		        (unsigned long long) timedOutWaits);
+	}
+}
+
 /* ===================================================================== */
 /* Instrumnetation functions                                             */
 /* ===================================================================== */
@@ -948,11 +1116,28 @@ int main(int argc, char *argv[])
 		return Usage();
 	}
 
+	if (!selectVectorClockKernels(KnobClockKernel.Value().c_str()))
+	{
+		fprintf(stderr, "vector clock kernels %s are unknown or not supported\n",
+		        KnobClockKernel.Value().c_str());
+		exit(1);
+	}
+
+	if (KnobMode.Value() == "races")
+	{
+		racesOnly = true;
+		loadRacingEpochs(KnobRaceFile.Value().c_str());
+	}
+	else if (KnobMode.Value() != "replay")
+	{
+		fprintf(stderr, "-mode must be replay or races\n");
+		exit(1);
+	}
+
 	InitLock(&atomic_create);
 	InitLock(&index_lock);
 	InitLock(&threadStartLock);
 	InitLock(&GRTLock);
-	InitLock(&epochListLock);
 
 	InitLock(&vector_lock);
 	InitLock(&mutex_map_lock);
@@ -965,6 +1150,7 @@ int main(int argc, char *argv[])
 	IMG_AddInstrumentFunction(ImgLoad, 0);
 	PIN_AddThreadStartFunction(ThreadStart, 0);
 	PIN_AddThreadFiniFunction(ThreadFini, 0);
+	PIN_AddFiniFunction(Fini, 0);
 
 	// Start the application
 	PIN_StartProgram();
@@ -1,5 +1,5 @@
 #include <limits.h>
-#include <cstdarg>
+#include <math.h>
 #include <string.h>
 #include <assert.h>
 
@@ -8,102 +8,319 @@
 #include <algorithm>
 
 #include "Bloom.h"
+#include "BloomKernels.h"
 #include "MurmurHash2.h"
 
-#define SETBIT(filter, n) (filter[n/CHAR_BIT] |= (1<<(n%CHAR_BIT)))
-#define UNSETBIT(filter, n) (filter[n/CHAR_BIT] &= ~(1<<(n%CHAR_BIT)))
-#define GETBIT(filter, n) (filter[n/CHAR_BIT] & (1<<(n%CHAR_BIT)))
+#define SETBIT(filter, n) (filter[n/64] |= (1UL<<(n%64)))
+#define UNSETBIT(filter, n) (filter[n/64] &= ~(1UL<<(n%64)))
+#define GETBIT(filter, n) (filter[n/64] & (1UL<<(n%64)))
 
-static unsigned int defaultHashFunction(const unsigned char * key)
+BloomGeometry bloomGeometry;
+
+/*
+ * Double hashing: the two halves of one 64 bit hash give the k indices
+ * h1 + i * h2. h2 is odd so the indices don't repeat for a power of two size.
+ */
+#define BLOOM_HASH1(hash) ((UINT32) (hash))
+#define BLOOM_HASH2(hash) ((UINT32) ((hash) >> 32) | 1)
+#define BLOOM_INDEX(hash, i, size) \
+	((BLOOM_HASH1(hash) + (i) * BLOOM_HASH2(hash)) & ((size) - 1))
+
+static inline UINT64 hashAddress(const unsigned char * key)
 {
-	return MurmurHash2(key, ADDR_SIZE, 0);
+	return MurmurHash64A(key, ADDR_SIZE, 0);
 }
 
-Bloom::Bloom()
+bool configureBloomGeometry(int size, int nfuncs, int expectedElements)
 {
-	int size = DEFAULT_BLOOM_FILTER_SIZE;
-	int nfuncs = 1;
+	if (size < BLOOM_WORD_BITS || (size & (size - 1)) != 0)
+	{
+		return false;
+	}
 
-	filter = (unsigned char *) calloc((size + CHAR_BIT - 1) / CHAR_BIT,
-	                                  sizeof(char));
-	funcs = (hashfunc_t*) malloc(nfuncs * sizeof(hashfunc_t));
+	if (nfuncs == 0)
+	{
+		if (expectedElements <= 0)
+		{
+			return false;
+		}
+		nfuncs = (int) ((double) size / expectedElements * M_LN2 + 0.5);
+		nfuncs = std::max(1, std::min(nfuncs, MAX_BLOOM_HASH_COUNT));
+	}
 
-	funcs[0] = defaultHashFunction;
+	if (nfuncs < 1 || nfuncs > MAX_BLOOM_HASH_COUNT)
+	{
+		return false;
+	}
 
-	this->nfuncs = nfuncs;
-	this->filterSize = size;
-	elementCount = 0;
+	bloomGeometry.size = size;
+	bloomGeometry.nfuncs = nfuncs;
+	if (expectedElements > 0)
+	{
+		bloomGeometry.bitsPerElement = std::max(1, size / expectedElements);
+	}
+	return true;
 }
 
-Bloom::Bloom(int size, int nfuncs, ...)
+bool configureAdaptiveSignatures(bool adaptive, int maxSize)
 {
-	va_list l;
+	if (maxSize < bloomGeometry.size || (maxSize & (maxSize - 1)) != 0)
+	{
+		return false;
+	}
 
-	filter = (unsigned char *) calloc((size + CHAR_BIT - 1) / CHAR_BIT,
-	                                  sizeof(char));
-	funcs = (hashfunc_t*) malloc(nfuncs * sizeof(hashfunc_t));
+	bloomGeometry.adaptive = adaptive;
+	bloomGeometry.maxSize = maxSize;
+	return true;
+}
 
-	va_start(l, nfuncs);
-	for (int n = 0; n < nfuncs; ++n)
+bool configureSignatureGranularity(const char* name)
+{
+	static const struct
+	{
+		const char* name;
+		ADDRINT granularity;
+	} granularities[] =
 	{
-		funcs[n] = va_arg(l, hashfunc_t);
+		{ "byte", GRANULARITY_BYTE },
+		{ "word", GRANULARITY_WORD },
+		{ "line", GRANULARITY_LINE },
+		{ "page", GRANULARITY_PAGE }
+	};
+
+	for (size_t i = 0; i < sizeof(granularities) / sizeof(granularities[0]);
+	        ++i)
+	{
+		if (strcmp(name, granularities[i].name) == 0)
+		{
+			bloomGeometry.granularity = granularities[i].granularity;
+			bloomGeometry.granularityShift = 0;
+			while ((1UL << bloomGeometry.granularityShift) <
+			        bloomGeometry.granularity)
+			{
+				bloomGeometry.granularityShift++;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+int Bloom::sizeFor(int expectedElements)
+{
+	if (!bloomGeometry.adaptive)
+	{
+		return bloomGeometry.size;
 	}
-	va_end(l);
+
+	// smaller epochs stay in the exact array, and a smaller filter would only
+	// saturate when a larger one is folded onto it
+	int size = bloomGeometry.size;
+	while (size < bloomGeometry.maxSize &&
+	        size / bloomGeometry.bitsPerElement < expectedElements)
+	{
+		size *= 2;
+	}
+	return size;
+}
+
+/*
+ * The filter is aligned and padded to BLOOM_ALIGN_BITS so that the kernels
+ * can always work on whole vectors. Padding bits are never set.
+ */
+static UINT64* allocateFilter(int size)
+{
+	size_t bytes = Bloom::filterWordCount(size) * sizeof(UINT64);
+	void* filter = NULL;
+	if (posix_memalign(&filter, BLOOM_ALIGN_BYTES, bytes) != 0)
+	{
+		fprintf(stderr, "Couldn't allocate a bloom filter of %d bits\n", size);
+		exit(1);
+	}
+	memset(filter, 0, bytes);
+	return (UINT64*) filter;
+}
+
+int Bloom::filterWordCount(int size)
+{
+	int alignedBits = (size + BLOOM_ALIGN_BITS - 1) / BLOOM_ALIGN_BITS
+	                  * BLOOM_ALIGN_BITS;
+	return alignedBits / BLOOM_WORD_BITS;
+}
+
+void Bloom::init(int size, int nfuncs)
+{
+	assert(size >= BLOOM_WORD_BITS && (size & (size - 1)) == 0);
+
+	filter = NULL;
+	exact = true;
 
 	this->nfuncs = nfuncs;
 	this->filterSize = size;
 	elementCount = 0;
 }
 
+Bloom::Bloom()
+{
+	init(bloomGeometry.size, bloomGeometry.nfuncs);
+}
+
+Bloom::Bloom(int size, int nfuncs)
+{
+	init(size, nfuncs);
+}
+
 Bloom::~Bloom()
 {
 	free(filter);
-	free(funcs);
+}
+
+/*
+ * Set the bits of the element with this hash, returns false if all of them
+ * were already set (most probably the element was already there)
+ */
+inline bool Bloom::setBits(UINT64 hash)
+{
+	UINT64 changed = 0;
+	for(int n=0; n < nfuncs; ++n)
+	{
+		UINT32 index = BLOOM_INDEX(hash, n, filterSize);
+		changed |= ~filter[index / 64] & (1UL << (index % 64));
+		SETBIT(filter, index);
+	}
+	return changed != 0;
+}
+
+inline bool Bloom::checkBits(UINT64 hash) const
+{
+	for(int n=0; n < nfuncs; ++n)
+	{
+		UINT32 index = BLOOM_INDEX(hash, n, filterSize);
+		if(!(GETBIT(filter, index)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Move the elements of the exact array into the filter
+ */
+void Bloom::spill()
+{
+	if (!filter)
+	{
+		filter = allocateFilter(filterSize);
+	}
+	else
+	{
+		bloomKernels.clear(filter, getFilterWordCount());
+	}
+
+	for (int i = 0; i < elementCount; ++i)
+	{
+		setBits(hashAddress(BLOOM_ADDR(elements[i])));
+	}
+	exact = false;
 }
 
 void Bloom::add(const unsigned char *s)
 {
 #ifndef SET_OVERRIDE
-	for(int n=0; n < nfuncs; ++n)
+	if (exact)
+	{
+		ADDRINT address = *((const ADDRINT*) s);
+		ADDRINT* end = elements + elementCount;
+		ADDRINT* pos = std::lower_bound(elements, end, address);
+		if (pos != end && *pos == address)
+		{
+			return;
+		}
+
+		if (elementCount < BLOOM_EXACT_CAPACITY)
+		{
+			std::copy_backward(pos, end, end + 1);
+			*pos = address;
+			elementCount++;
+			return;
+		}
+		spill();
+	}
+
+	if (setBits(hashAddress(s)))
 	{
-		SETBIT(filter, funcs[n](s)%filterSize);
+		elementCount++;
 	}
 #else
 	locations.insert(*((ADDRINT*) s));
-#endif
-
 	elementCount++;
+#endif
 }
 
 void Bloom::remove(ADDRINT removedAddress)
 {
 #ifndef SET_OVERRIDE
+	if (exact)
+	{
+		ADDRINT* end = elements + elementCount;
+		ADDRINT* pos = std::lower_bound(elements, end, removedAddress);
+		if (pos != end && *pos == removedAddress)
+		{
+			std::copy(pos + 1, end, pos);
+			elementCount--;
+		}
+		return;
+	}
+
+	// the bits may be shared with other elements, elementCount stays an upper
+	// bound and isEmpty checks the bits
+	UINT64 hash = hashAddress(BLOOM_ADDR(removedAddress));
 	for(int n=0; n < nfuncs; ++n)
 	{
-		UNSETBIT(filter, funcs[n](BLOOM_ADDR(removedAddress))%filterSize);
+		UINT32 index = BLOOM_INDEX(hash, n, filterSize);
+		UNSETBIT(filter, index);
 	}
 #else
 	locations.insert(removedAddress);
-#endif
 
 	// TODO: multiple elements could be removed from the filter but doesn't matter
 	elementCount--;
+#endif
 }
 
 const Bloom& Bloom::operator=(const Bloom& bloom)
 {
+	if (this == &bloom)
+	{
+		return *this;
+	}
+
+	// reuse the filter if the geometry is the same
+	if (filter && filterSize != bloom.filterSize)
+	{
+		free(filter);
+		filter = NULL;
+	}
 	nfuncs = bloom.nfuncs;
 	filterSize = bloom.filterSize;
 	elementCount = bloom.elementCount;
+	exact = bloom.exact;
 
-	filter = (unsigned char *) calloc((filterSize + CHAR_BIT - 1) / CHAR_BIT,
-	                                  sizeof(char));
-	funcs = (hashfunc_t*) malloc(nfuncs * sizeof(hashfunc_t));
-
-	memcpy(filter, bloom.filter, (filterSize + CHAR_BIT - 1) / CHAR_BIT);
-	memcpy(funcs, bloom.funcs, nfuncs * sizeof(hashfunc_t));
-
-#ifdef SET_OVERRIDE
+#ifndef SET_OVERRIDE
+	if (exact)
+	{
+		std::copy(bloom.elements, bloom.elements + elementCount, elements);
+	}
+	else
+	{
+		if (!filter)
+		{
+			filter = allocateFilter(filterSize);
+		}
+		memcpy(filter, bloom.filter, getFilterWordCount() * sizeof(UINT64));
+	}
+#else
 
 	locations = bloom.locations;
 #endif
@@ -111,32 +328,86 @@ const Bloom& Bloom::operator=(const Bloom& bloom)
 	return *this;
 }
 
-Bloom::Bloom(const Bloom& bloom)
+Bloom::Bloom(const Bloom& bloom) :
+		filterSize(0), filter(NULL), nfuncs(0), exact(true)
 {
 	(*this) = bloom;
 }
 
-bool Bloom::hasInCommon(const Bloom& bloom)
+/*
+ * Intersect filters of different sizes. The index of an element in the smaller
+ * filter is its index in the larger one modulo the smaller size, so the larger
+ * one is folded onto the smaller one chunk by chunk.
+ */
+bool Bloom::foldedIntersects(const Bloom& large, const Bloom& small)
 {
-#ifndef SET_OVERRIDE
-	assert(filterSize == bloom.filterSize);
-	int byteCount = getFilterSizeInBytes();
-	int same = 0;
+	int smallWords = small.filterSize / BLOOM_WORD_BITS;
+	int chunks = large.filterSize / small.filterSize;
 
-	for(int n = 0; n < byteCount; ++n)
+	for (int n = 0; n < smallWords; ++n)
 	{
-		if(filter[n] & bloom.filter[n])
+		UINT64 folded = 0;
+		for (int c = 0; c < chunks; ++c)
+		{
+			folded |= large.filter[c * smallWords + n];
+		}
+		if (folded & small.filter[n])
 		{
-#ifdef DEBUG_MODE
-			printf("%02X / %02X (%d) === Bits: %d | Bytes: %d | Byte#: %d\n", filter[n], bloom.filter[n], same, filterSize, byteCount, n);
-#endif
-
 			return true;
 		}
-		same++;
 	}
-
 	return false;
+}
+
+bool Bloom::intersects(const Bloom& a, const Bloom& b)
+{
+	if (a.elementCount == 0 || b.elementCount == 0)
+	{
+		return false;
+	}
+
+	if (a.exact && b.exact)
+	{
+		const ADDRINT* x = a.elements, *xEnd = a.elements + a.elementCount;
+		const ADDRINT* y = b.elements, *yEnd = b.elements + b.elementCount;
+		while (x != xEnd && y != yEnd)
+		{
+			if (*x < *y)
+				++x;
+			else if (*y < *x)
+				++y;
+			else
+				return true;
+		}
+		return false;
+	}
+
+	if (a.exact || b.exact)
+	{
+		const Bloom& e = a.exact ? a : b;
+		const Bloom& f = a.exact ? b : a;
+		for (int i = 0; i < e.elementCount; ++i)
+		{
+			if (f.checkBits(hashAddress(BLOOM_ADDR(e.elements[i]))))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	if (a.filterSize == b.filterSize)
+	{
+		return bloomKernels.intersect(a.filter, b.filter, a.getFilterWordCount());
+	}
+	return a.filterSize > b.filterSize ? foldedIntersects(a, b) :
+	       foldedIntersects(b, a);
+}
+
+bool Bloom::hasInCommon(const Bloom& bloom)
+{
+#ifndef SET_OVERRIDE
+	return intersects(*this, bloom);
 #else
 
 	std::vector<ADDRINT> v_intersection;
@@ -172,17 +443,73 @@ bool Bloom::hasInCommon(const Bloom& bloom)
 #endif
 }
 
+#ifdef SET_OVERRIDE
+static bool setsIntersect(const std::set<ADDRINT>& a, const std::set<ADDRINT>& b)
+{
+	std::set<ADDRINT>::const_iterator x = a.begin(), y = b.begin();
+	while (x != a.end() && y != b.end())
+	{
+		if (*x < *y)
+			++x;
+		else if (*y < *x)
+			++y;
+		else
+			return true;
+	}
+	return false;
+}
+
+void Bloom::printCommon(FILE* out, const Bloom& bloom) const
+{
+	std::vector<ADDRINT> v_intersection;
+	std::set_intersection(locations.begin(), locations.end(),
+	                      bloom.locations.begin(), bloom.locations.end(),
+	                      std::back_inserter(v_intersection));
+
+	for (unsigned int i = 0; i < v_intersection.size(); i++)
+	{
+		fprintf(out, "%lX, ", v_intersection[i]);
+	}
+	fprintf(out, "\n");
+}
+#endif
+
+/*
+ * BLOOM_CONFLICT_* mask of the conflicts between the signatures (r1, w1) and
+ * (r2, w2), with a single pass over the four filters.
+ */
+unsigned Bloom::conflicts(const Bloom& r1, const Bloom& w1, const Bloom& r2,
+                          const Bloom& w2)
+{
+#ifndef SET_OVERRIDE
+	// small or differently sized signatures are intersected pair by pair
+	if (!r1.exact && !w1.exact && !r2.exact && !w2.exact &&
+	        r1.filterSize == w1.filterSize && r1.filterSize == r2.filterSize &&
+	        r1.filterSize == w2.filterSize)
+	{
+		return bloomKernels.conflicts(r1.filter, w1.filter, r2.filter,
+		                              w2.filter, r1.getFilterWordCount());
+	}
+
+	return (intersects(r1, w2) ? BLOOM_CONFLICT_RW : 0) |
+	       (intersects(w1, r2) ? BLOOM_CONFLICT_WR : 0) |
+	       (intersects(w1, w2) ? BLOOM_CONFLICT_WW : 0);
+#else
+	return (setsIntersect(r1.locations, w2.locations) ? BLOOM_CONFLICT_RW : 0) |
+	       (setsIntersect(w1.locations, r2.locations) ? BLOOM_CONFLICT_WR : 0) |
+	       (setsIntersect(w1.locations, w2.locations) ? BLOOM_CONFLICT_WW : 0);
+#endif
+}
+
 bool Bloom::check(const unsigned char *s)
 {
 #ifndef SET_OVERRIDE
-	for(int n=0; n < nfuncs; ++n)
+	if (exact)
 	{
-		if(!(GETBIT(filter, funcs[n](s)%filterSize)))
-		{
-			return false;
-		}
+		return std::binary_search(elements, elements + elementCount,
+		                          *((const ADDRINT*) s));
 	}
-	return true;
+	return checkBits(hashAddress(s));
 #else
 
 	return locations.find(*((ADDRINT*) s)) != locations.end();
@@ -191,7 +518,12 @@ bool Bloom::check(const unsigned char *s)
 
 void Bloom::clear()
 {
-	memset(filter, 0, getFilterSizeInBytes());
+	// an exact signature left the filter untouched
+	if (!exact)
+	{
+		bloomKernels.clear(filter, getFilterWordCount());
+	}
+	exact = true;
 	elementCount = 0;
 
 #ifdef SET_OVERRIDE
@@ -200,18 +532,55 @@ void Bloom::clear()
 #endif
 }
 
+bool Bloom::getElements(std::vector<ADDRINT>& out) const
+{
+#ifndef SET_OVERRIDE
+	if (!exact)
+	{
+		return false;
+	}
+	out.assign(elements, elements + elementCount);
+#else
+
+	out.assign(locations.begin(), locations.end());
+#endif
+	return true;
+}
+
 bool Bloom::isEmpty()
 {
+#ifndef SET_OVERRIDE
+	// remove() may have cleared the bits of the remaining elements as well
+	return elementCount == 0 ||
+	       (!exact && bloomKernels.isEmpty(filter, getFilterWordCount()));
+#else
 	return elementCount == 0;
+#endif
+}
+
+/*
+ * Change the size of an empty signature, at the start of an epoch
+ */
+void Bloom::resize(int size)
+{
+	assert(elementCount == 0 && exact);
+	if (size != filterSize)
+	{
+		free(filter);
+		filter = NULL;
+		filterSize = size;
+	}
 }
 
 /**
- * Clear the filter between these positions
+ * Clear the filter between these positions. Only the keys whose whole
+ * granule is in the range are removed, a partial one may still be in use.
  */
 void Bloom::clear(ADDRINT startAddress, ADDRINT endAddress)
 {
-	ADDRINT address = startAddress;
-	for (; address < endAddress; address++)
+	ADDRINT granularity = bloomGeometry.granularity;
+	ADDRINT address = signatureKey(startAddress + granularity - 1);
+	for (; address + granularity <= endAddress; address += granularity)
 	{
 		remove(address);
 	}
@@ -219,10 +588,31 @@ void Bloom::clear(ADDRINT startAddress, ADDRINT endAddress)
 
 void Bloom::print(FILE* out)
 {
+#ifdef SET_OVERRIDE
+	for (std::set<ADDRINT>::iterator itr = locations.begin();
+	        itr != locations.end(); itr++)
+	{
+		fprintf(out, "%lX, ", *itr);
+	}
+	fprintf(out, "\n");
+	return;
+#endif
+
+	if (exact)
+	{
+		for (int i = 0; i < elementCount; ++i)
+		{
+			fprintf(out, "%lX, ", elements[i]);
+		}
+		fprintf(out, "\n");
+		return;
+	}
+
 	int size = getFilterSizeInBytes();
+	const unsigned char* bytes = getFilter();
 	for (int i = 0; i < size; ++i)
 	{
-		fprintf(out, "%02X", filter[i]);
+		fprintf(out, "%02X", bytes[i]);
 	}
 	fprintf(out, "\n");
 }
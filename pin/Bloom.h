@@ -7,17 +7,83 @@
 #include <vector>
 #include <set>
 #include "MyFlags.h"
+#include "BloomKernels.h"
 
 #define DEFAULT_BLOOM_FILTER_SIZE 2048
+#define DEFAULT_BLOOM_EXPECTED_ELEMENTS 256
+#define DEFAULT_MAX_BLOOM_FILTER_SIZE (1 << 18)
+#define MAX_BLOOM_HASH_COUNT 16
+
+// a signature keeps its elements in a sorted array up to this many
+#define BLOOM_EXACT_CAPACITY 32
+
+// granularities of the signature keys, in bytes
+#define GRANULARITY_BYTE 1
+#define GRANULARITY_WORD 8
+#define GRANULARITY_LINE 64
+#define GRANULARITY_PAGE 4096
+
+// never a key, whatever the granularity
+#define NO_SIGNATURE_KEY ((ADDRINT) -1)
 #define ADDR_SIZE 8
 #define BLOOM_ADDR(address) ((const unsigned char*) &address)
 
-typedef unsigned int (*hashfunc_t)(const unsigned char *);
+/*
+ * Size (a power of two, in bits) and hash count of the signatures created with
+ * the default constructor, set once from the knobs before any thread starts.
+ * When adaptive, the size is picked per epoch from the expected number of
+ * elements, keeping bitsPerElement and so the false positive rate.
+ */
+class BloomGeometry
+{
+public:
+	int size;
+	int nfuncs;
+	int bitsPerElement;
+	int maxSize;
+	bool adaptive;
+	ADDRINT granularity; // addresses are put in as granularity aligned keys
+	int granularityShift;
+
+	BloomGeometry() :
+			size(DEFAULT_BLOOM_FILTER_SIZE), nfuncs(1),
+			bitsPerElement(DEFAULT_BLOOM_FILTER_SIZE / DEFAULT_BLOOM_EXPECTED_ELEMENTS),
+			maxSize(DEFAULT_MAX_BLOOM_FILTER_SIZE), adaptive(false),
+			granularity(GRANULARITY_BYTE), granularityShift(0)
+	{}
+};
+
+extern BloomGeometry bloomGeometry;
+
+/*
+ * Set bloomGeometry. If nfuncs is 0, it's derived from the expected number of
+ * elements per epoch, k = m / n * ln 2. Returns false for a size that isn't a
+ * power of two or for a hash count out of [1, MAX_BLOOM_HASH_COUNT].
+ */
+bool configureBloomGeometry(int size, int nfuncs, int expectedElements);
+
+/*
+ * Let the sync hooks resize the signatures up to maxSize bits. Returns false if
+ * maxSize isn't a power of two or is smaller than the configured size.
+ */
+bool configureAdaptiveSignatures(bool adaptive, int maxSize);
+
+/*
+ * Set the signature granularity by name: "byte", "word", "line" or "page".
+ * Returns false for an unknown name.
+ */
+bool configureSignatureGranularity(const char* name);
+
+// key of the address at the signature granularity
+static inline ADDRINT signatureKey(ADDRINT address)
+{
+	return address & ~(bloomGeometry.granularity - 1);
+}
 
 class Bloom
 {
 public:
-	Bloom(int size, int nfuncs, ...);
+	Bloom(int size, int nfuncs);
 	Bloom();
 	const Bloom& operator=(const Bloom& bloom);
 	Bloom(const Bloom& bloom);
@@ -26,35 +92,93 @@ public:
 	void add(const unsigned char *s);
 	bool check(const unsigned char *s);
 	bool hasInCommon(const Bloom& bloom);
+	static unsigned conflicts(const Bloom& r1, const Bloom& w1, const Bloom& r2,
+	                          const Bloom& w2);
 	void clear();
 	void remove(ADDRINT removedAddress);
 	void clear(ADDRINT startAddress, ADDRINT endAddress);
 	bool isEmpty();
+	void resize(int size);
 	void print(FILE* out);
 
+	// size for an epoch of this many elements
+	static int sizeFor(int expectedElements);
+#ifdef SET_OVERRIDE
+	void printCommon(FILE* out, const Bloom& bloom) const;
+#endif
+
 	friend ostream& operator<<(ostream& os, const Bloom &v);
 
 	const unsigned char* getFilter()
 	{
-		return filter;
+		return (const unsigned char*) filter;
 	}
 
-	int getFilterSize()
+	int getFilterSize() const
 	{
 		return filterSize;
 	}
 
+	int getHashCount() const
+	{
+		return nfuncs;
+	}
+
+	// distinct elements added (an upper bound once out of the exact array)
+	int getElementCount() const
+	{
+		return elementCount;
+	}
+
+	bool isExact() const
+	{
+		return exact;
+	}
+
 	int getFilterSizeInBytes() const
 	{
 		return (filterSize + 7) / 8;
 	}
 
+	// number of 64 bit words allocated for the filter (including padding)
+	int getFilterWordCount() const
+	{
+		return filterWordCount(filterSize);
+	}
+
+	static int filterWordCount(int size);
+
+	// the filter, valid once getElements fails
+	const UINT64* getFilterWords() const
+	{
+		return filter;
+	}
+
+	// the elements, sorted, false once only the filter has them
+	bool getElements(std::vector<ADDRINT>& out) const;
+
+	// allocated beyond the object, the filter once out of the exact array
+	size_t getHeapBytes() const
+	{
+		return filter ? getFilterWordCount() * sizeof(UINT64) : 0;
+	}
+
 private:
 	int elementCount;
 	int filterSize;
-	unsigned char *filter;
+	UINT64 *filter; // allocated when the exact array overflows
 	int nfuncs;
-	hashfunc_t *funcs;
+
+	// the elements, sorted, until there are more than BLOOM_EXACT_CAPACITY
+	bool exact;
+	ADDRINT elements[BLOOM_EXACT_CAPACITY];
+
+	void init(int size, int nfuncs);
+	void spill();
+	bool setBits(UINT64 hash);
+	bool checkBits(UINT64 hash) const;
+	static bool intersects(const Bloom& a, const Bloom& b);
+	static bool foldedIntersects(const Bloom& large, const Bloom& small);
 
 #ifdef SET_OVERRIDE
 	std::set<ADDRINT> locations;
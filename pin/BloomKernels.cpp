@@ -0,0 +1,377 @@
+/*
+ * BloomKernels.cpp
+ *
+ * The byte kernels are the original Bloom loops and only kept as a baseline
+ * for the benchmark.
+ */
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "BloomKernels.h"
+#include "CpuFeatures.h"
+
+#ifdef CPU_HAVE_TARGET_ATTRIBUTE
+#define BLOOM_HAVE_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/*
+ * The fused conflict kernels OR the three intersections over a block and only
+ * test (and branch) once per block, so a conflict-free pair costs one pass
+ * over the four filters.
+ */
+#define CONFLICT_BLOCK_WORDS 32
+
+/* === BYTE =========================================================== */
+
+static bool intersectByte(const uint64_t* a, const uint64_t* b, size_t words)
+{
+	const unsigned char* x = (const unsigned char*) a;
+	const unsigned char* y = (const unsigned char*) b;
+	size_t bytes = words * sizeof(uint64_t);
+
+	for (size_t n = 0; n < bytes; ++n)
+	{
+		if (x[n] & y[n])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void clearByte(uint64_t* a, size_t words)
+{
+	memset(a, 0, words * sizeof(uint64_t));
+}
+
+static bool isEmptyByte(const uint64_t* a, size_t words)
+{
+	const unsigned char* x = (const unsigned char*) a;
+	size_t bytes = words * sizeof(uint64_t);
+
+	for (size_t n = 0; n < bytes; ++n)
+	{
+		if (x[n])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// three separate passes, like the original hasInCommon calls
+static unsigned conflictsByte(const uint64_t* r1, const uint64_t* w1,
+                              const uint64_t* r2, const uint64_t* w2,
+                              size_t words)
+{
+	return (intersectByte(r1, w2, words) ? BLOOM_CONFLICT_RW : 0) |
+	       (intersectByte(w1, r2, words) ? BLOOM_CONFLICT_WR : 0) |
+	       (intersectByte(w1, w2, words) ? BLOOM_CONFLICT_WW : 0);
+}
+
+/* === WORD =========================================================== */
+
+static bool intersectWord(const uint64_t* a, const uint64_t* b, size_t words)
+{
+	// words is a multiple of 4 (BLOOM_ALIGN_BITS)
+	for (size_t n = 0; n < words; n += 4)
+	{
+		if ((a[n] & b[n]) | (a[n + 1] & b[n + 1]) |
+		        (a[n + 2] & b[n + 2]) | (a[n + 3] & b[n + 3]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void clearWord(uint64_t* a, size_t words)
+{
+	for (size_t n = 0; n < words; ++n)
+	{
+		a[n] = 0;
+	}
+}
+
+static bool isEmptyWord(const uint64_t* a, size_t words)
+{
+	uint64_t any = 0;
+	for (size_t n = 0; n < words; ++n)
+	{
+		any |= a[n];
+	}
+	return any == 0;
+}
+
+static unsigned conflictsWord(const uint64_t* r1, const uint64_t* w1,
+                              const uint64_t* r2, const uint64_t* w2,
+                              size_t words)
+{
+	unsigned mask = 0;
+	for (size_t n = 0; n < words; n += CONFLICT_BLOCK_WORDS)
+	{
+		size_t end = n + CONFLICT_BLOCK_WORDS < words ? n + CONFLICT_BLOCK_WORDS :
+		             words;
+		uint64_t rw = 0, wr = 0, ww = 0;
+		for (size_t i = n; i < end; ++i)
+		{
+			rw |= r1[i] & w2[i];
+			wr |= w1[i] & r2[i];
+			ww |= w1[i] & w2[i];
+		}
+
+		mask |= (rw ? BLOOM_CONFLICT_RW : 0) | (wr ? BLOOM_CONFLICT_WR : 0) |
+		        (ww ? BLOOM_CONFLICT_WW : 0);
+		if (mask == BLOOM_CONFLICT_ALL)
+		{
+			break;
+		}
+	}
+	return mask;
+}
+
+/* === SSE2 =========================================================== */
+
+static inline bool isZeroSSE2(__m128i v)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xFFFF;
+}
+
+static bool intersectSSE2(const uint64_t* a, const uint64_t* b, size_t words)
+{
+	const __m128i* x = (const __m128i*) a;
+	const __m128i* y = (const __m128i*) b;
+
+	for (size_t n = 0; n < words / 2; n += 2)
+	{
+		__m128i v = _mm_or_si128(
+		                _mm_and_si128(_mm_load_si128(x + n), _mm_load_si128(y + n)),
+		                _mm_and_si128(_mm_load_si128(x + n + 1),
+		                              _mm_load_si128(y + n + 1)));
+		if (!isZeroSSE2(v))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void clearSSE2(uint64_t* a, size_t words)
+{
+	__m128i* x = (__m128i*) a;
+	__m128i zero = _mm_setzero_si128();
+
+	for (size_t n = 0; n < words / 2; ++n)
+	{
+		_mm_store_si128(x + n, zero);
+	}
+}
+
+static bool isEmptySSE2(const uint64_t* a, size_t words)
+{
+	const __m128i* x = (const __m128i*) a;
+	__m128i any = _mm_setzero_si128();
+
+	for (size_t n = 0; n < words / 2; ++n)
+	{
+		any = _mm_or_si128(any, _mm_load_si128(x + n));
+	}
+	return isZeroSSE2(any);
+}
+
+static unsigned conflictsSSE2(const uint64_t* r1, const uint64_t* w1,
+                              const uint64_t* r2, const uint64_t* w2,
+                              size_t words)
+{
+	const __m128i* xr = (const __m128i*) r1;
+	const __m128i* xw = (const __m128i*) w1;
+	const __m128i* yr = (const __m128i*) r2;
+	const __m128i* yw = (const __m128i*) w2;
+	size_t vectors = words / 2;
+	unsigned mask = 0;
+
+	for (size_t n = 0; n < vectors; n += CONFLICT_BLOCK_WORDS / 2)
+	{
+		size_t end = n + CONFLICT_BLOCK_WORDS / 2 < vectors ?
+		             n + CONFLICT_BLOCK_WORDS / 2 : vectors;
+		__m128i rw = _mm_setzero_si128();
+		__m128i wr = _mm_setzero_si128();
+		__m128i ww = _mm_setzero_si128();
+		for (size_t i = n; i < end; ++i)
+		{
+			__m128i a = _mm_load_si128(xr + i);
+			__m128i b = _mm_load_si128(xw + i);
+			__m128i c = _mm_load_si128(yr + i);
+			__m128i d = _mm_load_si128(yw + i);
+			rw = _mm_or_si128(rw, _mm_and_si128(a, d));
+			wr = _mm_or_si128(wr, _mm_and_si128(b, c));
+			ww = _mm_or_si128(ww, _mm_and_si128(b, d));
+		}
+
+		mask |= (isZeroSSE2(rw) ? 0 : BLOOM_CONFLICT_RW) |
+		        (isZeroSSE2(wr) ? 0 : BLOOM_CONFLICT_WR) |
+		        (isZeroSSE2(ww) ? 0 : BLOOM_CONFLICT_WW);
+		if (mask == BLOOM_CONFLICT_ALL)
+		{
+			break;
+		}
+	}
+	return mask;
+}
+
+/* === AVX2 =========================================================== */
+
+#ifdef BLOOM_HAVE_AVX2
+
+AVX2_TARGET
+static bool intersectAVX2(const uint64_t* a, const uint64_t* b, size_t words)
+{
+	const __m256i* x = (const __m256i*) a;
+	const __m256i* y = (const __m256i*) b;
+
+	for (size_t n = 0; n < words / 4; ++n)
+	{
+		__m256i v = _mm256_and_si256(_mm256_load_si256(x + n),
+		                             _mm256_load_si256(y + n));
+		if (!_mm256_testz_si256(v, v))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+AVX2_TARGET
+static void clearAVX2(uint64_t* a, size_t words)
+{
+	__m256i* x = (__m256i*) a;
+	__m256i zero = _mm256_setzero_si256();
+
+	for (size_t n = 0; n < words / 4; ++n)
+	{
+		_mm256_store_si256(x + n, zero);
+	}
+}
+
+AVX2_TARGET
+static bool isEmptyAVX2(const uint64_t* a, size_t words)
+{
+	const __m256i* x = (const __m256i*) a;
+	__m256i any = _mm256_setzero_si256();
+
+	for (size_t n = 0; n < words / 4; ++n)
+	{
+		any = _mm256_or_si256(any, _mm256_load_si256(x + n));
+	}
+	return _mm256_testz_si256(any, any);
+}
+
+AVX2_TARGET
+static unsigned conflictsAVX2(const uint64_t* r1, const uint64_t* w1,
+                              const uint64_t* r2, const uint64_t* w2,
+                              size_t words)
+{
+	const __m256i* xr = (const __m256i*) r1;
+	const __m256i* xw = (const __m256i*) w1;
+	const __m256i* yr = (const __m256i*) r2;
+	const __m256i* yw = (const __m256i*) w2;
+	size_t vectors = words / 4;
+	unsigned mask = 0;
+
+	for (size_t n = 0; n < vectors; n += CONFLICT_BLOCK_WORDS / 4)
+	{
+		size_t end = n + CONFLICT_BLOCK_WORDS / 4 < vectors ?
+		             n + CONFLICT_BLOCK_WORDS / 4 : vectors;
+		__m256i rw = _mm256_setzero_si256();
+		__m256i wr = _mm256_setzero_si256();
+		__m256i ww = _mm256_setzero_si256();
+		for (size_t i = n; i < end; ++i)
+		{
+			__m256i a = _mm256_load_si256(xr + i);
+			__m256i b = _mm256_load_si256(xw + i);
+			__m256i c = _mm256_load_si256(yr + i);
+			__m256i d = _mm256_load_si256(yw + i);
+			rw = _mm256_or_si256(rw, _mm256_and_si256(a, d));
+			wr = _mm256_or_si256(wr, _mm256_and_si256(b, c));
+			ww = _mm256_or_si256(ww, _mm256_and_si256(b, d));
+		}
+
+		mask |= (_mm256_testz_si256(rw, rw) ? 0 : BLOOM_CONFLICT_RW) |
+		        (_mm256_testz_si256(wr, wr) ? 0 : BLOOM_CONFLICT_WR) |
+		        (_mm256_testz_si256(ww, ww) ? 0 : BLOOM_CONFLICT_WW);
+		if (mask == BLOOM_CONFLICT_ALL)
+		{
+			break;
+		}
+	}
+	return mask;
+}
+
+#else
+
+// never selected, isBloomKernelSupported says no
+#define intersectAVX2 intersectSSE2
+#define clearAVX2     clearSSE2
+#define isEmptyAVX2   isEmptySSE2
+#define conflictsAVX2 conflictsSSE2
+
+#endif
+
+/* === DISPATCH ======================================================= */
+
+const BloomKernels bloomKernelTable[BLOOM_KERNEL_COUNT] =
+{
+	{ "byte", intersectByte, clearByte, isEmptyByte, conflictsByte },
+	{ "word", intersectWord, clearWord, isEmptyWord, conflictsWord },
+	{ "sse2", intersectSSE2, clearSSE2, isEmptySSE2, conflictsSSE2 },
+	{ "avx2", intersectAVX2, clearAVX2, isEmptyAVX2, conflictsAVX2 }
+};
+
+BloomKernels bloomKernels = bloomKernelTable[BLOOM_KERNEL_WORD];
+
+bool isBloomKernelSupported(BloomKernelType type)
+{
+	switch (type)
+	{
+	case BLOOM_KERNEL_BYTE:
+	case BLOOM_KERNEL_WORD:
+	case BLOOM_KERNEL_SSE2:
+		return true;
+	case BLOOM_KERNEL_AVX2:
+#ifdef BLOOM_HAVE_AVX2
+		return cpuHasAVX2();
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool selectBloomKernels(const char* name)
+{
+	if (strcmp(name, "auto") == 0)
+	{
+		BloomKernelType type = isBloomKernelSupported(BLOOM_KERNEL_AVX2) ?
+		                       BLOOM_KERNEL_AVX2 : BLOOM_KERNEL_SSE2;
+		bloomKernels = bloomKernelTable[type];
+		return true;
+	}
+
+	for (int type = 0; type < BLOOM_KERNEL_COUNT; type++)
+	{
+		if (strcmp(name, bloomKernelTable[type].name) == 0)
+		{
+			if (!isBloomKernelSupported((BloomKernelType) type))
+			{
+				return false;
+			}
+			bloomKernels = bloomKernelTable[type];
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,67 @@
+/*
+ * BloomKernels.h
+ *
+ * Word/SSE2/AVX2 kernels over the bit array of a Bloom filter, chosen at
+ * startup according to the running CPU. Doesn't depend on pin.H so that the
+ * micro benchmark in fasthashing/ can be built without Pin.
+ */
+
+#ifndef BLOOMKERNELS_H_
+#define BLOOMKERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// filters are allocated with this alignment and rounded up to this many bits
+// so that every kernel can work on whole vectors
+#define BLOOM_ALIGN_BYTES 32
+#define BLOOM_ALIGN_BITS  (BLOOM_ALIGN_BYTES * 8)
+#define BLOOM_WORD_BITS   64
+
+typedef bool (*BloomIntersectFunc)(const uint64_t* a, const uint64_t* b,
+                                   size_t words);
+typedef void (*BloomClearFunc)(uint64_t* a, size_t words);
+typedef bool (*BloomIsEmptyFunc)(const uint64_t* a, size_t words);
+
+// conflict classes between the signatures (r1, w1) and (r2, w2)
+#define BLOOM_CONFLICT_RW  1 // r1 & w2
+#define BLOOM_CONFLICT_WR  2 // w1 & r2
+#define BLOOM_CONFLICT_WW  4 // w1 & w2
+#define BLOOM_CONFLICT_ALL 7
+
+typedef unsigned (*BloomConflictFunc)(const uint64_t* r1, const uint64_t* w1,
+                                      const uint64_t* r2, const uint64_t* w2,
+                                      size_t words);
+
+typedef enum
+{
+	BLOOM_KERNEL_BYTE, BLOOM_KERNEL_WORD, BLOOM_KERNEL_SSE2, BLOOM_KERNEL_AVX2,
+	BLOOM_KERNEL_COUNT
+} BloomKernelType;
+
+class BloomKernels
+{
+public:
+	const char* name;
+	BloomIntersectFunc intersect; // true if a & b has a bit set
+	BloomClearFunc clear;
+	BloomIsEmptyFunc isEmpty;
+	BloomConflictFunc conflicts; // BLOOM_CONFLICT_* mask, one pass over all four
+};
+
+// kernels used by Bloom, the portable word kernels until selected
+extern BloomKernels bloomKernels;
+
+// all kernels, indexed by BloomKernelType
+extern const BloomKernels bloomKernelTable[BLOOM_KERNEL_COUNT];
+
+bool isBloomKernelSupported(BloomKernelType type);
+
+/*
+ * Select the kernels by name ("byte", "word", "sse2", "avx2") or the best
+ * supported one for "auto". Returns false if the name is unknown or not
+ * supported by the CPU, keeping the previous selection.
+ */
+bool selectBloomKernels(const char* name);
+
+#endif /* BLOOMKERNELS_H_ */
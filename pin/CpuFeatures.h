@@ -0,0 +1,61 @@
+/*
+ * CpuFeatures.h
+ *
+ * cpuid checks used to pick the SIMD kernels at startup. Doesn't depend on
+ * pin.H so that the micro benchmarks in fasthashing/ can be built without Pin.
+ */
+
+#ifndef CPUFEATURES_H_
+#define CPUFEATURES_H_
+
+#include <stdint.h>
+
+// the target attribute (and so SSE4.1/AVX2 code in an SSE2 build) needs gcc 4.9
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CPU_HAVE_TARGET_ATTRIBUTE
+#endif
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* regs)
+{
+	__asm__ __volatile__("cpuid"
+	                     : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+	                     : "a"(leaf), "c"(subleaf));
+}
+
+static inline bool cpuHasSSE41()
+{
+	uint32_t regs[4];
+	cpuid(1, 0, regs);
+	return regs[2] & (1 << 19);
+}
+
+static inline bool cpuHasAVX2()
+{
+	uint32_t regs[4];
+	cpuid(0, 0, regs);
+	if (regs[0] < 7)
+	{
+		return false;
+	}
+
+	// the OS has to save the ymm registers too (OSXSAVE + XCR0 bits 1,2)
+	cpuid(1, 0, regs);
+	if (!(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28)))
+	{
+		return false;
+	}
+
+	uint32_t xcr0Low, xcr0High;
+	__asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" // xgetbv
+	                     : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	if ((xcr0Low & 6) != 6)
+	{
+		return false;
+	}
+
+	cpuid(7, 0, regs);
+	return regs[1] & (1 << 5);
+}
+
+#endif /* CPUFEATURES_H_ */
@@ -0,0 +1,79 @@
+/*
+ * EpochConvert.cpp
+ *
+ * Turns a binary epoch log (-epochFormat binary) back into the text form,
+ * a line of comma separated clock components per epoch. The signatures are
+ * dropped, the text logs don't have them.
+ *
+ * Compile with "make epochconvert", run as
+ * ./epochconvert thread_epochs.0 [thread_epochs.0.txt]
+ */
+
+#include <stdio.h>
+#include <vector>
+
+#include "EpochLogFormat.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s binary-log [text-log]\n", argv[0]);
+		return 1;
+	}
+
+	FILE* in = fopen(argv[1], "rb");
+	if (!in)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<unsigned char> log;
+	unsigned char chunk[1 << 16];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+	{
+		log.insert(log.end(), chunk, chunk + n);
+	}
+	fclose(in);
+
+	const unsigned char* begin = log.empty() ? NULL : &log[0];
+	EpochLogReader reader(begin, begin + log.size());
+	if (!reader.isValid())
+	{
+		fprintf(stderr, "%s is not a binary epoch log\n", argv[1]);
+		return 1;
+	}
+
+	FILE* out = argc == 3 ? fopen(argv[2], "w") : stdout;
+	if (!out)
+	{
+		perror(argv[2]);
+		return 1;
+	}
+
+	std::vector<uint32_t> clock;
+	size_t epochs = 0;
+	while (reader.next(clock))
+	{
+		for (size_t i = 0; i + 1 < clock.size(); i++)
+		{
+			fprintf(out, "%u,", clock[i]);
+		}
+		fprintf(out, "%u\n", clock.empty() ? 0 : clock[clock.size() - 1]);
+		epochs++;
+	}
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+
+	fprintf(stderr, "thread %u, slot %u: %lu epochs\n", reader.getTid(),
+	        reader.getSlot(), (unsigned long) epochs);
+	if (!reader.atEnd())
+	{
+		fprintf(stderr, "%s is truncated after the last one\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
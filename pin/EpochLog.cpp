@@ -0,0 +1,150 @@
+/*
+ * EpochLog.cpp
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "EpochLog.h"
+
+bool EpochLog::binary = false;
+bool EpochLog::signatures = false;
+
+EpochLog::EpochLog(FILE* out, UINT32 tid, UINT32 slot) :
+		out(out), used(0)
+{
+	buffer = (unsigned char*) malloc(EPOCH_LOG_BUFFER_SIZE);
+	if (!buffer)
+	{
+		fprintf(stderr, "Couldn't allocate an epoch log buffer\n");
+		exit(1);
+	}
+
+	if (binary)
+	{
+		memcpy(reserve(EPOCH_LOG_MAGIC_SIZE), EPOCH_LOG_MAGIC,
+		       EPOCH_LOG_MAGIC_SIZE);
+		used += EPOCH_LOG_MAGIC_SIZE;
+		putVarint(signatures ? EPOCH_LOG_SIGNATURES : 0);
+		putVarint(tid);
+		putVarint(slot);
+	}
+}
+
+EpochLog::~EpochLog()
+{
+	flush();
+	free(buffer);
+}
+
+void EpochLog::write(const VectorClock& clock, const Bloom& r, const Bloom& w)
+{
+	if (!binary)
+	{
+		writeText(clock);
+	}
+	else
+	{
+		writeBinary(clock);
+		if (signatures)
+		{
+			writeSignature(r);
+			writeSignature(w);
+		}
+	}
+
+#ifdef PRINT_SYNC_FUNCTION
+	// the sync functions are printed to the file right after the clock
+	flush();
+#endif
+}
+
+void EpochLog::flush()
+{
+	if (used)
+	{
+		fwrite(buffer, 1, used, out);
+		used = 0;
+	}
+	fflush(out);
+}
+
+// like VectorClock::printVector, a clock without components prints a 0
+void EpochLog::writeText(const VectorClock& clock)
+{
+	UINT32 size = clock.getSize();
+	for (UINT32 i = 0; i == 0 || i < size; i++)
+	{
+		char digits[10];
+		int n = 0;
+		UINT32 value = clock.get(i);
+		do
+		{
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while (value);
+
+		unsigned char* p = reserve(n + 1);
+		while (n)
+		{
+			*p++ = digits[--n];
+		}
+		*p++ = i + 1 < size ? ',' : '\n';
+		used = p - buffer;
+	}
+}
+
+void EpochLog::writeBinary(const VectorClock& clock)
+{
+	UINT32 size = clock.getSize();
+	previous.resize(size);
+
+	UINT32 changed = 0;
+	for (UINT32 i = 0; i < size; i++)
+	{
+		changed += clock.get(i) != previous[i];
+	}
+	putVarint(size);
+	putVarint(changed);
+
+	UINT32 last = (UINT32) -1;
+	for (UINT32 i = 0; changed && i < size; i++)
+	{
+		UINT32 value = clock.get(i);
+		if (value == previous[i])
+		{
+			continue;
+		}
+		putVarint(i - last);
+		putVarint(zigzag((INT64) value - (INT64) previous[i]));
+		previous[i] = value;
+		last = i;
+		changed--;
+	}
+}
+
+void EpochLog::writeSignature(const Bloom& bloom)
+{
+	if (bloom.getElements(elements))
+	{
+		putVarint(EPOCH_SIGNATURE_SET);
+		putVarint(elements.size());
+		ADDRINT last = 0;
+		for (size_t i = 0; i < elements.size(); i++)
+		{
+			putVarint(elements[i] - last);
+			last = elements[i];
+		}
+		return;
+	}
+
+	putVarint(EPOCH_SIGNATURE_FILTER);
+	putVarint(bloom.getFilterSize());
+	putVarint(bloom.getHashCount());
+	const UINT64* words = bloom.getFilterWords();
+	for (int i = 0; i < (bloom.getFilterSize() + 63) / 64; i++)
+	{
+		memcpy(reserve(sizeof(UINT64)), &words[i], sizeof(UINT64));
+		used += sizeof(UINT64);
+	}
+}
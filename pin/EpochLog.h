@@ -0,0 +1,67 @@
+/*
+ * EpochLog.h
+ *
+ * Per thread log of the clocks at the end of the epochs, read by pin-replay.
+ * Written through a buffer of the thread that only goes to the file when
+ * full and at ThreadFini, as text (a line of comma separated components per
+ * epoch) or in the binary form of EpochLogFormat.h, see -epochFormat.
+ */
+
+#ifndef EPOCHLOG_H_
+#define EPOCHLOG_H_
+
+#include "pin.H"
+
+#include <stdio.h>
+#include <vector>
+
+#include "VectorClock.h"
+#include "Bloom.h"
+#include "EpochLogFormat.h"
+
+#define EPOCH_LOG_BUFFER_SIZE (1 << 20)
+
+class EpochLog
+{
+public:
+	// the header of a binary log is written right away
+	EpochLog(FILE* out, UINT32 tid, UINT32 slot);
+	~EpochLog();
+
+	void write(const VectorClock& clock, const Bloom& r, const Bloom& w);
+	void flush();
+
+	// set from the knobs before any thread starts
+	static bool binary;
+	static bool signatures; // binary only
+
+private:
+	void writeText(const VectorClock& clock);
+	void writeBinary(const VectorClock& clock);
+	void writeSignature(const Bloom& bloom);
+
+	// room for bytes more, flushing if needed
+	unsigned char* reserve(size_t bytes)
+	{
+		if (used + bytes > EPOCH_LOG_BUFFER_SIZE)
+		{
+			flush();
+		}
+		return buffer + used;
+	}
+
+	void putVarint(UINT64 value)
+	{
+		used += ::putVarint(reserve(MAX_VARINT_SIZE), value);
+	}
+
+	FILE* out;
+	unsigned char* buffer;
+	size_t used;
+
+	// clock of the previous epoch, the binary log has the changes to it
+	std::vector<UINT32> previous;
+	std::vector<ADDRINT> elements;
+};
+
+#endif /* EPOCHLOG_H_ */
@@ -0,0 +1,117 @@
+/*
+ * EpochLogFormat.cpp
+ */
+
+#include <string.h>
+
+#include "EpochLogFormat.h"
+
+bool isBinaryEpochLog(const unsigned char* begin, const unsigned char* end)
+{
+	return end - begin >= EPOCH_LOG_MAGIC_SIZE &&
+	       !memcmp(begin, EPOCH_LOG_MAGIC, EPOCH_LOG_MAGIC_SIZE);
+}
+
+EpochLogReader::EpochLogReader(const unsigned char* begin,
+                               const unsigned char* end) :
+		in(begin), end(end), valid(false), flags(0), tid(0), slot(0)
+{
+	if (!isBinaryEpochLog(begin, end))
+	{
+		return;
+	}
+	in += EPOCH_LOG_MAGIC_SIZE;
+
+	uint64_t value;
+	if (!getVarint(in, end, flags) || !getVarint(in, end, value))
+	{
+		return;
+	}
+	tid = (uint32_t) value;
+	if (!getVarint(in, end, value))
+	{
+		return;
+	}
+	slot = (uint32_t) value;
+	valid = true;
+}
+
+bool EpochLogReader::next(std::vector<uint32_t>& clock)
+{
+	// a truncated epoch is left unread
+	const unsigned char* start = in;
+	if (!valid || in >= end || !readEpoch())
+	{
+		in = start;
+		return false;
+	}
+
+	clock = previous;
+	return true;
+}
+
+bool EpochLogReader::readEpoch()
+{
+	uint64_t size, changed, value;
+	if (!getVarint(in, end, size) || !getVarint(in, end, changed))
+	{
+		return false;
+	}
+
+	previous.resize(size);
+	uint64_t index = (uint64_t) -1;
+	for (uint64_t i = 0; i < changed; i++)
+	{
+		if (!getVarint(in, end, value))
+		{
+			return false;
+		}
+		index += value;
+		if (index >= size || !getVarint(in, end, value))
+		{
+			return false;
+		}
+		previous[index] += (uint32_t) unzigzag(value);
+	}
+
+	return !hasSignatures() || (skipSignature() && skipSignature());
+}
+
+bool EpochLogReader::skipSignature()
+{
+	uint64_t kind, count, value;
+	if (!getVarint(in, end, kind))
+	{
+		return false;
+	}
+
+	if (kind == EPOCH_SIGNATURE_SET)
+	{
+		if (!getVarint(in, end, count))
+		{
+			return false;
+		}
+		for (uint64_t i = 0; i < count; i++)
+		{
+			if (!getVarint(in, end, value))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// the filter words follow its size and hash count
+	if (kind != EPOCH_SIGNATURE_FILTER || !getVarint(in, end, count) ||
+	        !getVarint(in, end, value))
+	{
+		return false;
+	}
+	uint64_t bytes = (count + 63) / 64 * sizeof(uint64_t);
+	if (bytes > (uint64_t) (end - in))
+	{
+		return false;
+	}
+	in += bytes;
+	return true;
+}
@@ -0,0 +1,148 @@
+/*
+ * EpochLogFormat.h
+ *
+ * Binary form of the per thread epoch logs (-epochFormat binary), read back
+ * by epochconvert and pin-replay. Doesn't depend on pin.H so that the
+ * converter can be built without Pin.
+ *
+ * The log starts with EPOCH_LOG_MAGIC, then the flags, the Pin thread id and
+ * the clock slot of the thread. Every epoch is then
+ *
+ *   components of the clock
+ *   number of components changed since the previous epoch of the log
+ *   for each of them, the distance from the previous changed one (from -1)
+ *   and the difference to its previous value
+ *   with EPOCH_LOG_SIGNATURES, the read then the write signature
+ *
+ * A signature is EPOCH_SIGNATURE_SET, the element count and the sorted
+ * elements as differences to the previous one (from 0), or
+ * EPOCH_SIGNATURE_FILTER, the size in bits, the hash count and the 64 bit
+ * words of the filter in the byte order of the writer. All the numbers are
+ * LEB128 varints, the differences of the components zigzag coded.
+ */
+
+#ifndef EPOCHLOGFORMAT_H_
+#define EPOCHLOGFORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define EPOCH_LOG_MAGIC "SGEPOCH1"
+#define EPOCH_LOG_MAGIC_SIZE 8
+
+// flags of the header
+#define EPOCH_LOG_SIGNATURES 1
+
+#define EPOCH_SIGNATURE_SET    0
+#define EPOCH_SIGNATURE_FILTER 1
+
+// bytes of a varint of 64 bits at most
+#define MAX_VARINT_SIZE 10
+
+// writes value at out, returns the bytes written
+static inline size_t putVarint(unsigned char* out, uint64_t value)
+{
+	size_t n = 0;
+	while (value >= 0x80)
+	{
+		out[n++] = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+	out[n++] = (unsigned char) value;
+	return n;
+}
+
+// false if the varint runs past end
+static inline bool getVarint(const unsigned char*& in, const unsigned char* end,
+                             uint64_t& value)
+{
+	value = 0;
+	for (int shift = 0; in < end && shift < 64; shift += 7)
+	{
+		unsigned char byte = *in++;
+		value |= (uint64_t) (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// the log in [begin, end) is a binary one
+bool isBinaryEpochLog(const unsigned char* begin, const unsigned char* end);
+
+/*
+ * Decodes the clocks of a binary log held in memory, skipping the signatures
+ */
+class EpochLogReader
+{
+public:
+	EpochLogReader(const unsigned char* begin, const unsigned char* end);
+
+	// the header was read
+	bool isValid() const
+	{
+		return valid;
+	}
+
+	bool hasSignatures() const
+	{
+		return flags & EPOCH_LOG_SIGNATURES;
+	}
+
+	uint32_t getTid() const
+	{
+		return tid;
+	}
+
+	uint32_t getSlot() const
+	{
+		return slot;
+	}
+
+	/*
+	 * The components of the next epoch's clock, false at the end of the log
+	 * or at a truncated epoch
+	 */
+	bool next(std::vector<uint32_t>& clock);
+
+	// all of the log was read
+	bool atEnd() const
+	{
+		return in >= end;
+	}
+
+	// where the next epoch starts
+	const unsigned char* getPosition() const
+	{
+		return in;
+	}
+
+private:
+	bool readEpoch();
+	bool skipSignature();
+
+	const unsigned char* in;
+	const unsigned char* end;
+	bool valid;
+	uint64_t flags;
+	uint32_t tid;
+	uint32_t slot;
+
+	// clock of the previous epoch, the changes apply to it
+	std::vector<uint32_t> previous;
+};
+
+#endif /* EPOCHLOGFORMAT_H_ */
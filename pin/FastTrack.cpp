@@ -0,0 +1,224 @@
+/*
+ * FastTrack.cpp
+ *
+ * The thread's own clock is only changed by the thread itself (in the sync
+ * hooks), so the accesses read it without a lock. The races found under a
+ * stripe lock are reported after releasing it, since looking up the source
+ * location takes the client lock. The epochs of both accesses of a new race
+ * go to raceInfoFile as well.
+ */
+
+#include <string>
+#include <algorithm>
+
+#include "FastTrack.h"
+#include "Bloom.h"
+#include "RecordNReplay.h"
+
+FastTrackDetector* fastTrack = NULL;
+
+class PendingRace
+{
+public:
+	const char* type;
+	THREADID otherTid;
+	ADDRINT otherPc;
+	Epoch otherEpoch;
+};
+
+// c@t happens before the accessing thread
+static inline bool covered(Epoch epoch, const VectorClock& clock)
+{
+	return EPOCH_CLOCK(epoch) <= clock.get(EPOCH_SLOT(epoch));
+}
+
+FastTrackDetector::FastTrackDetector(unsigned granularityShift) :
+		shadow(granularityShift), raceCount(0)
+{
+	for (int i = 0; i < FASTTRACK_LOCK_COUNT; i++)
+	{
+		InitLock(&locks[i].lock);
+	}
+	InitLock(&reportLock);
+}
+
+// the granules of [addr, addr + size) are from first to last
+static inline ADDRINT lastKey(ADDRINT addr, UINT32 size)
+{
+	return signatureKey(addr + (size ? size - 1 : 0));
+}
+
+void FastTrackDetector::read(THREADID tid, const VectorClock& clock,
+                             ADDRINT addr, UINT32 size, ADDRINT pc)
+{
+	ADDRINT last = lastKey(addr, size);
+	for (ADDRINT key = signatureKey(addr); key <= last;
+	        key += bloomGeometry.granularity)
+	{
+		readGranule(tid, clock, key, std::max(key, addr), pc);
+	}
+}
+
+void FastTrackDetector::write(THREADID tid, const VectorClock& clock,
+                              ADDRINT addr, UINT32 size, ADDRINT pc)
+{
+	ADDRINT last = lastKey(addr, size);
+	for (ADDRINT key = signatureKey(addr); key <= last;
+	        key += bloomGeometry.granularity)
+	{
+		writeGranule(tid, clock, key, std::max(key, addr), pc);
+	}
+}
+
+// addr is the first byte of the access in the granule, for the reports
+void FastTrackDetector::readGranule(THREADID tid, const VectorClock& clock,
+                                    ADDRINT key, ADDRINT addr, ADDRINT pc)
+{
+	UINT32 slot = clock.threadId;
+	UINT32 now = clock.get(slot);
+	PendingRace races[1];
+	int raceFound = 0;
+
+	ShadowWord& word = *shadow.lookup(key);
+	PIN_LOCK& lock = lockOf(key);
+	GetLock(&lock, tid + 1);
+
+	// already read in this epoch
+	if (word.readClock ? word.readClock->get(slot) == now :
+	        word.read == EPOCH(slot, now))
+	{
+		ReleaseLock(&lock);
+		return;
+	}
+
+	if (!covered(word.write, clock))
+	{
+		PendingRace race = { "w-r", word.writeTid, word.writePc, word.write };
+		races[raceFound++] = race;
+	}
+
+	if (word.readClock)
+	{
+		word.readClock->set(slot, now);
+	}
+	else if (!covered(word.read, clock))
+	{
+		// concurrent readers, keep all of them from now on
+		word.readClock = new VectorClock();
+		word.readClock->set(EPOCH_SLOT(word.read), EPOCH_CLOCK(word.read));
+		word.readClock->set(slot, now);
+	}
+	word.read = EPOCH(slot, now);
+	word.readTid = tid;
+	word.readPc = pc;
+
+	ReleaseLock(&lock);
+
+	for (int i = 0; i < raceFound; i++)
+	{
+		reportRace(races[i].type, addr, tid, pc, EPOCH(slot, now),
+		           races[i].otherTid, races[i].otherPc, races[i].otherEpoch);
+	}
+}
+
+void FastTrackDetector::writeGranule(THREADID tid, const VectorClock& clock,
+                                     ADDRINT key, ADDRINT addr, ADDRINT pc)
+{
+	UINT32 slot = clock.threadId;
+	Epoch now = EPOCH(slot, clock.get(slot));
+	PendingRace races[2];
+	int raceFound = 0;
+
+	ShadowWord& word = *shadow.lookup(key);
+	PIN_LOCK& lock = lockOf(key);
+	GetLock(&lock, tid + 1);
+
+	// already written in this epoch
+	if (word.write == now)
+	{
+		ReleaseLock(&lock);
+		return;
+	}
+
+	if (!covered(word.write, clock))
+	{
+		PendingRace race = { "w-w", word.writeTid, word.writePc, word.write };
+		races[raceFound++] = race;
+	}
+
+	// with several readers the last one is reported, it may not be the
+	// (only) concurrent one
+	if (word.readClock ? !word.readClock->lessEqual(clock) :
+	        !covered(word.read, clock))
+	{
+		PendingRace race = { "r-w", word.readTid, word.readPc, word.read };
+		races[raceFound++] = race;
+	}
+
+	// the reads are ordered before this write from now on
+	if (word.readClock)
+	{
+		delete word.readClock;
+		word.readClock = NULL;
+		word.read = EMPTY_EPOCH;
+	}
+	word.write = now;
+	word.writeTid = tid;
+	word.writePc = pc;
+
+	ReleaseLock(&lock);
+
+	for (int i = 0; i < raceFound; i++)
+	{
+		reportRace(races[i].type, addr, tid, pc, now, races[i].otherTid,
+		           races[i].otherPc, races[i].otherEpoch);
+	}
+}
+
+void FastTrackDetector::reportRace(const char* type, ADDRINT addr,
+                                   THREADID tid, ADDRINT pc, Epoch epoch,
+                                   THREADID otherTid, ADDRINT otherPc,
+                                   Epoch otherEpoch)
+{
+	GetLock(&reportLock, tid + 1);
+	raceCount++;
+	bool isNew = reportedPcs.insert(std::make_pair(std::min(pc, otherPc),
+	                                std::max(pc, otherPc))).second;
+	ReleaseLock(&reportLock);
+
+	if (!isNew)
+	{
+		return;
+	}
+
+	INT32 column, line, otherLine;
+	std::string file, otherFile;
+	PIN_LockClient();
+	PIN_GetSourceLocation(pc, &column, &line, &file);
+	PIN_GetSourceLocation(otherPc, &column, &otherLine, &otherFile);
+	PIN_UnlockClient();
+
+	fprintf(stderr,
+	        "THERE IS A DATA RACE %s ON 0x%lx BETWEEN THREAD-%d (PC 0x%lx %s:%d) "
+	        "& THREAD-%d (PC 0x%lx %s:%d) !!!\n", type, (unsigned long) addr,
+	        otherTid, (unsigned long) otherPc, otherFile.c_str(), otherLine, tid,
+	        (unsigned long) pc, file.c_str(), line);
+	fflush(stderr);
+	fprintf(raceInfoFile, "%u %u %u %u %u %u\n", tid, EPOCH_SLOT(epoch),
+	        EPOCH_CLOCK(epoch), otherTid, EPOCH_SLOT(otherEpoch),
+	        EPOCH_CLOCK(otherEpoch));
+}
+
+void FastTrackDetector::release(ADDRINT from, ADDRINT to)
+{
+	shadow.release(from, to);
+}
+
+void FastTrackDetector::printStats(FILE* out)
+{
+	fprintf(out, "# fasttrack\n");
+	fprintf(out, "# races racing-pc-pairs\n");
+	fprintf(out, "%llu %lu\n", (unsigned long long) raceCount,
+	        (unsigned long) reportedPcs.size());
+	shadow.printStats(out);
+}
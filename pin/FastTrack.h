@@ -0,0 +1,81 @@
+/*
+ * FastTrack.h
+ *
+ * Exact race detector in the style of FastTrack (Flanagan & Freund, PLDI'09),
+ * selected with -detector fasttrack instead of the signatures. Every granule
+ * (see -granularity) keeps the epoch of its last write and of its last read,
+ * or a read clock while it is read concurrently, checked against the vector
+ * clock of the accessing thread on every access, for each granule the access
+ * covers. Races are reported with the address and the pcs of both accesses.
+ *
+ * The shadow words live in a ShadowMemory table, found without locking. They
+ * are updated under striped locks chosen by address, so that threads touching
+ * different data don't serialize.
+ */
+
+#ifndef FASTTRACK_H_
+#define FASTTRACK_H_
+
+#include "pin.H"
+
+#include <stdio.h>
+#include <set>
+#include <utility>
+
+#include "VectorClock.h"
+#include "ShadowMemory.h"
+
+// power of two, a cache line always falls under a single lock
+#define FASTTRACK_LOCK_COUNT 256
+#define FASTTRACK_LOCK_SHIFT 6
+
+class LockStripe
+{
+public:
+	PIN_LOCK lock;
+} __attribute__((aligned(64)));
+
+class FastTrackDetector
+{
+public:
+	FastTrackDetector(unsigned granularityShift);
+
+	// access of size bytes at addr
+	void read(THREADID tid, const VectorClock& clock, ADDRINT addr,
+	          UINT32 size, ADDRINT pc);
+	void write(THREADID tid, const VectorClock& clock, ADDRINT addr,
+	           UINT32 size, ADDRINT pc);
+
+	// the block [from, to) was freed
+	void release(ADDRINT from, ADDRINT to);
+
+	void printStats(FILE* out);
+
+private:
+	PIN_LOCK& lockOf(ADDRINT key)
+	{
+		return locks[(key >> FASTTRACK_LOCK_SHIFT) & (FASTTRACK_LOCK_COUNT - 1)].lock;
+	}
+
+	void readGranule(THREADID tid, const VectorClock& clock, ADDRINT key,
+	                 ADDRINT addr, ADDRINT pc);
+	void writeGranule(THREADID tid, const VectorClock& clock, ADDRINT key,
+	                  ADDRINT addr, ADDRINT pc);
+
+	void reportRace(const char* type, ADDRINT addr, THREADID tid, ADDRINT pc,
+	                Epoch epoch, THREADID otherTid, ADDRINT otherPc,
+	                Epoch otherEpoch);
+
+	LockStripe locks[FASTTRACK_LOCK_COUNT];
+	ShadowMemory shadow;
+
+	// every pair of racing instructions is reported once
+	PIN_LOCK reportLock;
+	std::set<std::pair<ADDRINT, ADDRINT> > reportedPcs;
+	UINT64 raceCount;
+};
+
+// NULL unless -detector fasttrack
+extern FastTrackDetector* fastTrack;
+
+#endif /* FASTTRACK_H_ */
@@ -4,6 +4,7 @@
 #include "pin.H"
 #include "SigraceModules.h"
 #include "MyFlags.h"
+#include "EpochLog.h"
 #include <deque>
 
 #define CONVERT(type, data_ptr) ((type)((void*)data_ptr))
@@ -14,6 +15,9 @@
 
 #define NOT_A_THREADID 0xFFFFFFFF
 
+// entries of the per thread cache of the keys inserted in the epoch
+#define INSERT_CACHE_SIZE 64
+
 extern TLS_KEY tlsKey;
 
 typedef map<pthread_t, THREADID> PthreadPinIdMap;
@@ -28,10 +32,53 @@ typedef ChildVCMap::iterator ChildVCMapItr;
 #define EASSERT_MSG(expr, err_msg, ...) \
 	assert((expr) || (printf(err_msg, __VA_ARGS__) && 0))
 
+/*
+ * Direct-mapped cache of the keys put into a signature since the last flush,
+ * so that a repeated access returns before hashing
+ */
+class InsertCache
+{
+public:
+	ADDRINT keys[INSERT_CACHE_SIZE];
+	UINT64 hits;
+	UINT64 misses;
+
+	InsertCache() :
+			hits(0), misses(0)
+	{
+		flush();
+	}
+
+	void flush()
+	{
+		for (int i = 0; i < INSERT_CACHE_SIZE; i++)
+		{
+			keys[i] = NO_SIGNATURE_KEY;
+		}
+	}
+
+	// true if the key is cached, otherwise it's cached now
+	bool lookup(ADDRINT key)
+	{
+		ADDRINT& slot = keys[(key >> bloomGeometry.granularityShift) &
+		                     (INSERT_CACHE_SIZE - 1)];
+		if (slot == key)
+		{
+			hits++;
+			return true;
+		}
+
+		slot = key;
+		misses++;
+		return false;
+	}
+};
+
 class ThreadLocalStorage
 {
 public:
 	FILE* out;
+	EpochLog* epochLog; // buffers what goes to out
 	VectorClock* vectorClock;
 
 	ChildVCMap joinVCMap;
@@ -46,9 +93,21 @@ public:
 	ADDRINT nextReallocAddr;
 	ADDRINT nextReallocSize;
 
+	// [stackLow, stackHigh) is private to the thread
+	ADDRINT stackLow;
+	ADDRINT stackHigh;
+
+	// running estimate of the distinct addresses per epoch, sizes the filters
+	int footprintEstimate;
+
+	// keys recently put into the signatures in this epoch
+	InsertCache readCache;
+	InsertCache writeCache;
+
 	ThreadLocalStorage()
 	{
 		out = NULL;
+		epochLog = NULL;
 		vectorClock = NULL;
 		readBloomFilter = NULL;
 		writeBloomFilter = NULL;
@@ -59,10 +118,18 @@ public:
 		nextMallocSize = 0;
 		nextReallocAddr = 0;
 		nextReallocSize = 0;
+
+		stackLow = 0;
+		stackHigh = 0;
+
+		footprintEstimate = 0;
 	}
 
 	~ThreadLocalStorage()
 	{
+		if(epochLog)
+			delete epochLog;
+
 		if(out)
 			fclose(out);
 
@@ -8,11 +8,12 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <assert.h>
+#include <sys/resource.h>
+#include <algorithm>
 
 #include "MultiCacheSim_PinDriver.h"
 #include "Bloom.h"
-
-ADDRINT STACK_PTR_ERROR = 1000;
+#include "FastTrack.h"
 
 std::vector<MultiCacheSim *> Caches;
 MultiCacheSim *ReferenceProtocol;
@@ -20,9 +21,24 @@ PIN_LOCK mccLock;
 
 bool stopOnError = false;
 bool printOnError = false;
+bool splitInstrumentation = true;
+bool staticElision = true;
+bool elideFramePointer = false;
+
+// per image static elision counters, updated while instrumenting (serialized
+// by Pin) and reported at Fini
+ImageStatsMap imageStatsMap;
 
 unsigned long instrumentationStatus[MAX_NTHREADS];
 
+// signature inserts skipped (hits) or done (misses) by the finished threads
+UINT64 insertCacheHits = 0;
+UINT64 insertCacheMisses = 0;
+
+// stack of each thread, set in ThreadStart. An empty range (unknown stack)
+// makes every access of the thread shared.
+StackRange threadStacks[MAX_NTHREADS];
+
 VOID TurnInstrumentationOn(ADDRINT tid)
 {
 	instrumentationStatus[PIN_ThreadId()] = true;
@@ -33,42 +49,175 @@ VOID TurnInstrumentationOff(ADDRINT tid)
 	instrumentationStatus[PIN_ThreadId()] = false;
 }
 
-BOOL isMemoryGlobal(ADDRINT effectiveAddr, ADDRINT stackPtr)
+/*
+ * Anything outside the stack of the accessing thread is global or in heap
+ * --> shared. A single unsigned compare, so that it can be inlined into
+ * IsSharedAccess.
+ */
+static inline BOOL isMemoryGlobal(THREADID tid, ADDRINT effectiveAddr)
+{
+	return effectiveAddr - threadStacks[tid].low >= threadStacks[tid].size;
+}
+
+/*
+ * Find the stack holding the given stack pointer in /proc/self/maps, like
+ * pthread_getattr_np does. The main stack is the [stack] mapping. A thread
+ * stack is an anonymous mapping right above its guard page (---p), but the
+ * kernel merges it with the anonymous memory mapped above it (heap, malloc
+ * arenas), so only the guard page and the stack pointer the thread starts
+ * with are trusted: its frames all go below that. A stack without a guard
+ * page, in the heap or in a file mapping isn't accepted, it would hide real
+ * shared accesses.
+ */
+static bool findStackMapping(ADDRINT stackPtr, ADDRINT* low, ADDRINT* high,
+                             bool* isMainStack)
 {
-	//if stack pointer is greater, it is global or in heap --> shared
-	if (static_cast<UINT64>(abs(stackPtr - effectiveAddr)) >
-	        STACK_PTR_ERROR)
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (!maps)
 	{
-		return true;
+		return false;
+	}
+
+	char line[512];
+	bool found = false;
+	unsigned long previousTo = 0;
+	bool previousIsGuard = false;
+	while (fgets(line, sizeof(line), maps))
+	{
+		unsigned long from, to;
+		char perms[8] = "";
+		char name[256] = "";
+		if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %255s", &from, &to, perms,
+		           name) < 3)
+		{
+			continue;
+		}
+
+		if (stackPtr >= from && stackPtr < to)
+		{
+			*isMainStack = strcmp(name, "[stack]") == 0;
+			if (*isMainStack)
+			{
+				*low = from;
+				*high = to;
+				found = true;
+			}
+			else if (name[0] == '\0' && previousIsGuard && previousTo == from)
+			{
+				*low = from;
+				*high = stackPtr;
+				found = true;
+			}
+			break;
+		}
+
+		previousTo = to;
+		previousIsGuard = strcmp(perms, "---p") == 0;
 	}
 
-	return false;
+	fclose(maps);
+	return found;
 }
 
-VOID addToReadFilter(THREADID tid, ADDRINT addr, ADDRINT stackPtr)
+/*
+ * Record the bounds of the stack the thread starts on
+ */
+bool initThreadStack(THREADID tid, ADDRINT stackPtr, ADDRINT* low, ADDRINT* high)
 {
-	if (isMemoryGlobal(addr, stackPtr))
+	bool isMainStack = false;
+	if (!findStackMapping(stackPtr, low, high, &isMainStack))
 	{
-		ThreadLocalStorage* tls =
-		    static_cast<ThreadLocalStorage*>(PIN_GetThreadData(tlsKey, tid));
-		Bloom* readSig = tls->readBloomFilter;
+		*low = *high = 0;
+		fprintf(stderr, "Couldn't find the stack of thread %d, all of its "
+		        "accesses are treated as shared\n", tid);
+	}
+	else
+	{
+		// the main stack grows on demand up to the stack limit, a thread
+		// stack is no larger than it (the default size of glibc)
+		struct rlimit limit;
+		if (getrlimit(RLIMIT_STACK, &limit) == 0 &&
+		        limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < *high)
+		{
+			ADDRINT limitLow = *high - limit.rlim_cur;
+			*low = isMainStack ? std::min(*low, limitLow) :
+			       std::max(*low, limitLow);
+		}
+	}
+
+	threadStacks[tid].low = *low;
+	threadStacks[tid].size = *high - *low;
+	return *high != *low;
+}
+
+/*
+ * The read/write filters of a thread are only touched by the thread itself
+ * (the sync hooks snapshot them into a SigRaceData before handing them to the
+ * rdm), so no lock is needed to add an address.
+ */
+static VOID insertRead(THREADID tid, ADDRINT addr)
+{
+	ThreadLocalStorage* tls =
+	    static_cast<ThreadLocalStorage*>(PIN_GetThreadData(tlsKey, tid));
+	Bloom* readSig = tls->readBloomFilter;
 
 #ifdef WRITE_ADDRESSES_TO_LOG_FILE
 
-		fprintf(tls->out, "R : %lX\n", addr);
+	fprintf(tls->out, "R : %lX\n", addr);
 #endif
 
-		GetLock(&rdmLock, tid + 1);
-		readSig->add(BLOOM_ADDR(addr));
-		ReleaseLock(&rdmLock);
+	// recent accesses to the same granule add nothing
+	ADDRINT key = signatureKey(addr);
+	if (tls->readCache.lookup(key))
+	{
+		return;
 	}
+
+#ifdef LOCKED_SIGNATURE_INSERT
+	GetLock(&rdmLock, tid + 1);
+	readSig->add(BLOOM_ADDR(key));
+	ReleaseLock(&rdmLock);
+#else
+	readSig->add(BLOOM_ADDR(key));
+#endif
+}
+
+VOID addToReadFilter(THREADID tid, ADDRINT addr)
+{
+	if (isMemoryGlobal(tid, addr))
+	{
+		insertRead(tid, addr);
+	}
+}
+
+static VOID checkRead(THREADID tid, ADDRINT addr, UINT32 size, ADDRINT pc)
+{
+	ThreadLocalStorage* tls =
+	    static_cast<ThreadLocalStorage*>(PIN_GetThreadData(tlsKey, tid));
+	fastTrack->read(tid, *tls->vectorClock, addr, size, pc);
 }
 
 //void Read(THREADID tid, ADDRINT addr, ADDRINT inst)
-void Read(THREADID tid, ADDRINT addr, ADDRINT stackPtr, const char* imageName,
-          ADDRINT inst, UINT32 readSize)
+void Read(THREADID tid, ADDRINT addr, const char* imageName, ADDRINT inst,
+          UINT32 readSize)
 {
-	addToReadFilter(tid, addr, stackPtr);
+	// between INSTRUMENT_OFF and INSTRUMENT_ON, like IsSharedAccess
+	if (!instrumentationStatus[tid])
+	{
+		return;
+	}
+
+	if (fastTrack)
+	{
+		if (isMemoryGlobal(tid, addr))
+		{
+			checkRead(tid, addr, readSize, inst);
+		}
+	}
+	else
+	{
+		addToReadFilter(tid, addr);
+	}
 
 	/* addition of MultiCacheSim coherency protocols */
 	/*
@@ -104,30 +253,69 @@ void Read(THREADID tid, ADDRINT addr, ADDRINT stackPtr, const char* imageName,
 	 */
 }
 
-VOID addToWriteFilter(THREADID tid, ADDRINT addr, ADDRINT stackPtr)
+static VOID insertWrite(THREADID tid, ADDRINT addr)
 {
-	if (isMemoryGlobal(addr, stackPtr))
-	{
-		ThreadLocalStorage* tls =
-		    static_cast<ThreadLocalStorage*>(PIN_GetThreadData(tlsKey, tid));
-		Bloom* writeSig = tls->writeBloomFilter;
+	ThreadLocalStorage* tls =
+	    static_cast<ThreadLocalStorage*>(PIN_GetThreadData(tlsKey, tid));
+	Bloom* writeSig = tls->writeBloomFilter;
 
 #ifdef WRITE_ADDRESSES_TO_LOG_FILE
 
-		fprintf(tls->out, "W : %lX\n", addr);
+	fprintf(tls->out, "W : %lX\n", addr);
+#endif
+
+	// recent accesses to the same granule add nothing
+	ADDRINT key = signatureKey(addr);
+	if (tls->writeCache.lookup(key))
+	{
+		return;
+	}
+
+#ifdef LOCKED_SIGNATURE_INSERT
+	GetLock(&rdmLock, tid + 1);
+	writeSig->add(BLOOM_ADDR(key));
+	ReleaseLock(&rdmLock);
+#else
+	writeSig->add(BLOOM_ADDR(key));
 #endif
+}
 
-		GetLock(&rdmLock, tid + 1);
-		writeSig->add(BLOOM_ADDR(addr));
-		ReleaseLock(&rdmLock);
+VOID addToWriteFilter(THREADID tid, ADDRINT addr)
+{
+	if (isMemoryGlobal(tid, addr))
+	{
+		insertWrite(tid, addr);
 	}
 }
 
+static VOID checkWrite(THREADID tid, ADDRINT addr, UINT32 size, ADDRINT pc)
+{
+	ThreadLocalStorage* tls =
+	    static_cast<ThreadLocalStorage*>(PIN_GetThreadData(tlsKey, tid));
+	fastTrack->write(tid, *tls->vectorClock, addr, size, pc);
+}
+
 //void Write(THREADID tid, ADDRINT addr, ADDRINT inst)
-void Write(THREADID tid, ADDRINT addr, ADDRINT stackPtr, const char* imageName,
-           ADDRINT inst, UINT32 writeSize)
+void Write(THREADID tid, ADDRINT addr, const char* imageName, ADDRINT inst,
+           UINT32 writeSize)
 {
-	addToWriteFilter(tid, addr, stackPtr);
+	// between INSTRUMENT_OFF and INSTRUMENT_ON, like IsSharedAccess
+	if (!instrumentationStatus[tid])
+	{
+		return;
+	}
+
+	if (fastTrack)
+	{
+		if (isMemoryGlobal(tid, addr))
+		{
+			checkWrite(tid, addr, writeSize, inst);
+		}
+	}
+	else
+	{
+		addToWriteFilter(tid, addr);
+	}
 
 	/*
 	 GetLock(&mccLock, 1);
@@ -163,33 +351,221 @@ void Write(THREADID tid, ADDRINT addr, ADDRINT stackPtr, const char* imageName,
 	 */
 }
 
-void processMemoryWriteInstruction(INS ins, const char* imageName)
+/*
+ * Split (if/then) instrumentation: IsSharedAccess has no calls or branches so
+ * Pin can inline it, and the signature insert is only called for the accesses
+ * that may touch shared memory.
+ */
+ADDRINT PIN_FAST_ANALYSIS_CALL IsSharedAccess(THREADID tid,
+        ADDRINT effectiveAddr)
+{
+	return instrumentationStatus[tid] & isMemoryGlobal(tid, effectiveAddr);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL ReadThen(THREADID tid, ADDRINT effectiveAddr)
+{
+	insertRead(tid, effectiveAddr);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL WriteThen(THREADID tid, ADDRINT effectiveAddr)
+{
+	insertWrite(tid, effectiveAddr);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL CheckReadThen(THREADID tid, ADDRINT effectiveAddr,
+        UINT32 size, ADDRINT pc)
+{
+	checkRead(tid, effectiveAddr, size, pc);
+}
+
+VOID PIN_FAST_ANALYSIS_CALL CheckWriteThen(THREADID tid, ADDRINT effectiveAddr,
+        UINT32 size, ADDRINT pc)
+{
+	checkWrite(tid, effectiveAddr, size, pc);
+}
+
+/*
+ * The then call goes to the signature insert, or with the exact detector to
+ * the shadow check, which also gets the size of the access and its pc for
+ * the reports
+ */
+static void insertSplitCall(INS ins, UINT32 memOp, bool isWrite)
+{
+	INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) IsSharedAccess,
+	                           IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID,
+	                           IARG_MEMORYOP_EA, memOp,
+	                           IARG_CALL_ORDER, CALL_ORDER_FIRST + 30, IARG_END);
+
+	if (fastTrack)
+	{
+		INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE,
+		                             isWrite ? (AFUNPTR) CheckWriteThen :
+		                             (AFUNPTR) CheckReadThen,
+		                             IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID,
+		                             IARG_MEMORYOP_EA, memOp,
+		                             isWrite ? IARG_MEMORYWRITE_SIZE : IARG_MEMORYREAD_SIZE,
+		                             IARG_INST_PTR, IARG_CALL_ORDER, CALL_ORDER_FIRST + 30, IARG_END);
+		return;
+	}
+
+	INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE,
+	                             isWrite ? (AFUNPTR) WriteThen : (AFUNPTR) ReadThen,
+	                             IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID,
+	                             IARG_MEMORYOP_EA, memOp,
+	                             IARG_CALL_ORDER, CALL_ORDER_FIRST + 30, IARG_END);
+}
+
+static ImageStats* getImageStats(IMG img)
+{
+	ImageStatsMapItr itr = imageStatsMap.find(IMG_Id(img));
+	if (itr != imageStatsMap.end())
+	{
+		return itr->second;
+	}
+
+	ImageStats* stats = new ImageStats(IMG_Name(img));
+	for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+	{
+		if (!SEC_IsWriteable(sec) && SEC_Size(sec) > 0)
+		{
+			stats->readOnlyAreas.push_back(
+			    MemoryArea(0, SEC_Address(sec), SEC_Address(sec) + SEC_Size(sec)));
+		}
+	}
+
+	imageStatsMap[IMG_Id(img)] = stats;
+	return stats;
+}
+
+// count the operand once, however often its trace is instrumented
+static inline void countOperand(INS ins, UINT32 memOp, bool isWrite,
+                                ImageStats* stats, unsigned long* counter)
+{
+	if (stats->counted.insert(std::make_pair(INS_Address(ins),
+	                          memOp * 2 + isWrite)).second)
+	{
+		(*counter)++;
+	}
+}
+
+/*
+ * Decide at instrumentation time whether a memory operand may touch shared
+ * memory. Operands addressed off the stack (or frame) pointer without an
+ * index register, and rip-relative reads of read-only sections, can't.
+ */
+static bool mayBeShared(INS ins, UINT32 memOp, bool isWrite, ImageStats* stats)
+{
+	if (!staticElision)
+	{
+		countOperand(ins, memOp, isWrite, stats, &stats->instrumented);
+		return true;
+	}
+
+	UINT32 op = INS_MemoryOperandIndexToOperandIndex(ins, memOp);
+	REG base = INS_OperandMemoryBaseReg(ins, op);
+	REG index = INS_OperandMemoryIndexReg(ins, op);
+
+	if (!REG_valid(index))
+	{
+		if (base == REG_STACK_PTR || (elideFramePointer && base == REG_GBP))
+		{
+			countOperand(ins, memOp, isWrite, stats, &stats->elidedStack);
+			return false;
+		}
+
+		if (base == REG_INST_PTR && !isWrite)
+		{
+			ADDRINT target = INS_Address(ins) + INS_Size(ins)
+			                 + INS_OperandMemoryDisplacement(ins, op);
+			std::vector<MemoryArea>::const_iterator itr;
+			for (itr = stats->readOnlyAreas.begin();
+			        itr != stats->readOnlyAreas.end(); itr++)
+			{
+				if (target >= itr->from && target < itr->to)
+				{
+					countOperand(ins, memOp, isWrite, stats,
+					             &stats->elidedConstant);
+					return false;
+				}
+			}
+		}
+	}
+
+	countOperand(ins, memOp, isWrite, stats, &stats->instrumented);
+	return true;
+}
+
+void printInstrumentationStats(FILE* out)
+{
+	fprintf(out, "# static memory operand counts per image\n");
+	fprintf(out, "# instrumented elided-stack elided-constant image\n");
+
+	ImageStatsMapItr itr;
+	for (itr = imageStatsMap.begin(); itr != imageStatsMap.end(); itr++)
+	{
+		ImageStats* stats = itr->second;
+		fprintf(out, "%lu %lu %lu %s\n", stats->instrumented,
+		        stats->elidedStack, stats->elidedConstant, stats->name.c_str());
+	}
+
+	UINT64 inserts = insertCacheHits + insertCacheMisses;
+	fprintf(out, "# signature insert cache\n");
+	fprintf(out, "# hits misses hit-rate\n");
+	fprintf(out, "%llu %llu %.4f\n", (unsigned long long) insertCacheHits,
+	        (unsigned long long) insertCacheMisses,
+	        inserts ? (double) insertCacheHits / inserts : 0.0);
+	fflush(out);
+}
+
+void processMemoryWriteInstruction(INS ins, const char* imageName,
+                                   ImageStats* stats)
 {
 	UINT32 memoryOperandCount = INS_MemoryOperandCount(ins);
 	for (UINT32 i = 0; i < memoryOperandCount; ++i)
 	{
 		if (INS_MemoryOperandIsWritten(ins, i) && INS_OperandIsMemory(ins, i))
 		{
+			if (!mayBeShared(ins, i, true, stats))
+			{
+				continue;
+			}
+
+			if (splitInstrumentation)
+			{
+				insertSplitCall(ins, i, true);
+				continue;
+			}
+
 			INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) Write,
-			                         IARG_THREAD_ID, IARG_MEMORYOP_EA, i, IARG_REG_VALUE,
-			                         REG_STACK_PTR, //pass current stack ptr
+			                         IARG_THREAD_ID, IARG_MEMORYOP_EA, i,
 			                         IARG_PTR, imageName, IARG_INST_PTR, IARG_MEMORYWRITE_SIZE,
 			                         IARG_CALL_ORDER, CALL_ORDER_FIRST + 30, IARG_END);
 		}
 	}
 }
 
-void processMemoryReadInstruction(INS ins, const char* imageName)
+void processMemoryReadInstruction(INS ins, const char* imageName,
+                                  ImageStats* stats)
 {
 	UINT32 memoryOperandCount = INS_MemoryOperandCount(ins);
 	for (UINT32 i = 0; i < memoryOperandCount; ++i)
 	{
 		if (INS_MemoryOperandIsRead(ins, i))
 		{
+			if (!mayBeShared(ins, i, false, stats))
+			{
+				continue;
+			}
+
+			if (splitInstrumentation)
+			{
+				insertSplitCall(ins, i, false);
+				continue;
+			}
+
 			INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) Read,
-			                         IARG_THREAD_ID, IARG_MEMORYOP_EA, i, IARG_REG_VALUE,
-			                         REG_STACK_PTR, //pass current stack ptr
-			                         IARG_PTR, imageName, IARG_INST_PTR, IARG_MEMORYWRITE_SIZE,
+			                         IARG_THREAD_ID, IARG_MEMORYOP_EA, i,
+			                         IARG_PTR, imageName, IARG_INST_PTR, IARG_MEMORYREAD_SIZE,
 			                         IARG_CALL_ORDER, CALL_ORDER_FIRST + 30, IARG_END);
 		}
 	}
@@ -203,13 +579,14 @@ VOID instrumentTrace(TRACE trace, VOID *v)
 		return;
 
 	const char* imageName = IMG_Name(img).c_str();
+	ImageStats* stats = getImageStats(img);
 
 	for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
 	{
 		for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
 		{
-			processMemoryWriteInstruction(ins, imageName);
-			processMemoryReadInstruction(ins, imageName);
+			processMemoryWriteInstruction(ins, imageName, stats);
+			processMemoryReadInstruction(ins, imageName, stats);
 		}
 	}
 }
@@ -250,115 +627,27 @@ static MemorySetItr smallestOverlappingMemoryArea(const MemoryArea& area)
 	return itr;
 }
 
+/*
+ * The block starting at from, end() if there is none. Areas are ordered by
+ * where they end, the one byte area at from only matches the block holding it
+ */
 #pragma INLINE
-static const MemoryArea& findMemoryArea(ADDRINT from)
+static MemorySetItr findMemoryArea(ADDRINT from)
 {
-	MemoryArea area(0, from, 0);
-	MemorySetItr itr = memorySet.find(area);
-	return *itr;
+	MemorySetItr itr = memorySet.find(MemoryArea(0, from, from + 1));
+	return itr != memorySet.end() && itr->from == from ? itr : memorySet.end();
 }
 
-//#pragma INLINE
-//static bool hasOverlappingArea(MemoryArea& area)
-//{
-//	MemorySetItr itr = memorySet.lower_bound(area);
-//	return itr != memorySet.end() && ((MemoryArea) *itr).overlaps(area);
-//}
-
-static VOID moveMemoryAddresses(ADDRINT startOfOldPlace,
-                                ADDRINT startOfNewPlace, UINT32 size, THREADID tid)
-{
-	/*
-	 ADDRINT maxSize = (startOfOldPlace + size);
-	 ADDRINT newMemAddrTmp;
-	 variablesHashMap* tmpHashMap;
-	 MemoryAddr* tmpMemAddr = NULL;
-	 MemoryAddr* newTmpMemAddrObj = NULL;
-
-	 ADDRINT difference = 0;
-	 for (ADDRINT currentAddress = startOfOldPlace; currentAddress <= maxSize;
-	 ++currentAddress)
-	 {
-	 GetLock(
-	 &variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask], tid);
-	 tmpHashMap = allMemoryLocations.getVariableHashMap(currentAddress);
-	 if (tmpHashMap == NULL || (*tmpHashMap).count(currentAddress) == 0)
-	 {
-	 ReleaseLock (&variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask]);
-	 continue;
-	 }
-	 tmpMemAddr = (*tmpHashMap)[currentAddress];
-	 difference = currentAddress - startOfOldPlace;
-	 ReleaseLock (&variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask]);
-
-	 newMemAddrTmp = startOfNewPlace + difference;
-
-	 GetLock(
-	 &variablePinLocks[(newMemAddrTmp >> 3)
-	 & allMemoryLocations.bitMask], tid);
-	 tmpHashMap = allMemoryLocations.getVariableHashMap(newMemAddrTmp);
-	 if (tmpHashMap == NULL)
-	 {
-	 ReleaseLock(
-	 &variablePinLocks[(newMemAddrTmp >> 3)
-	 & allMemoryLocations.bitMask]);
-	 continue;
-	 }
-	 //cout << "moved:" << currentAddress << "  to:" << newMemAddrTmp << endl;
-	 newTmpMemAddrObj = new MemoryAddr(newMemAddrTmp, true); //yeni mem adresi olustur
-	 (*tmpHashMap)[newMemAddrTmp] = newTmpMemAddrObj;
-	 newTmpMemAddrObj->readerVectorClock = tmpMemAddr->readerVectorClock; //vector clocklari al
-	 newTmpMemAddrObj->writerVectorClock = tmpMemAddr->writerVectorClock;
-	 tmpMemAddr->readerVectorClock = NULL; //eskinin vectorClocklari null'a
-	 tmpMemAddr->writerVectorClock = NULL;
-	 ReleaseLock(
-	 &variablePinLocks[(newMemAddrTmp >> 3)
-	 & allMemoryLocations.bitMask]);
-
-	 GetLock(
-	 &variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask], tid);
-	 tmpHashMap = allMemoryLocations.getVariableHashMap(currentAddress);
-	 tmpHashMap->erase(currentAddress);
-	 delete tmpMemAddr;
-	 ReleaseLock(
-	 &variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask]);
-	 }
-	 */
-}
-
-static VOID freeMemoryAddress(ADDRINT memoryAddrFreeStarts,
-                              ADDRINT maxMemoryAddrToBeFreed, THREADID threadid)
+/*
+ * The application is done with [from, to), the shadow of a new block there
+ * must start empty
+ */
+static VOID freeMemoryAddress(ADDRINT from, ADDRINT to, THREADID tid)
 {
-	/*
-	 variablesHashMap* tmpHashMap;
-	 for (ADDRINT currentAddress = memoryAddrFreeStarts;
-	 currentAddress <= maxMemoryAddrToBeFreed; ++currentAddress)
-	 {
-	 GetLock(
-	 &variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask], threadid);
-	 tmpHashMap = allMemoryLocations.getVariableHashMap(currentAddress);
-
-	 if (tmpHashMap == NULL || (*tmpHashMap).count(currentAddress) == 0)
-	 {
-	 ReleaseLock (&variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask]);
-	 continue;
-	 }
-
-	 delete (*tmpHashMap)[currentAddress]->writerVectorClock;
-	 delete (*tmpHashMap)[currentAddress]->readerVectorClock;
-
-	 (*tmpHashMap).erase(currentAddress);
-	 ReleaseLock (&variablePinLocks[(currentAddress >> 3)
-	 & allMemoryLocations.bitMask]);
-	 }
-	 */
+	if (fastTrack)
+	{
+		fastTrack->release(from, to);
+	}
 }
 
 VOID ReallocEnter(CHAR * name, ADDRINT previousAddress, ADDRINT newSize,
@@ -374,52 +663,55 @@ VOID ReallocAfter(ADDRINT mallocStartAddr, THREADID tid)
 	ThreadLocalStorage* tls = getTLS(tid);
 	ADDRINT previousAddress = tls->nextReallocAddr;
 	ADDRINT newSize = tls->nextReallocSize;
+	tls->nextReallocAddr = 0;
+	tls->nextReallocSize = 0;
 
 	//if previous address is NULL, this is the same as malloc
 	if (previousAddress == 0)
 	{
-		tls->nextMallocSize = tls->nextReallocSize;
-		tls->nextReallocAddr = 0;
-		tls->nextReallocSize = 0;
+		tls->nextMallocSize = newSize;
 		MallocAfter(mallocStartAddr, tid);
 		return;
 	}
 
-	const MemoryArea& prevArea = findMemoryArea(mallocStartAddr);
-	MemoryArea newArea(tid, mallocStartAddr, mallocStartAddr + newSize);
+	// failed, the old block is still there
+	if (mallocStartAddr == 0 && newSize != 0)
+	{
+		return;
+	}
 
-	ADDRINT prevSize = prevArea.to - prevArea.from;
+	GetLock(&memorySetLock, tid + 1);
+	MemorySetItr itr = findMemoryArea(previousAddress);
+	if (itr == memorySet.end())
+	{
+		// allocated before the hooks were in place
+		ReleaseLock(&memorySetLock);
+		tls->nextMallocSize = newSize;
+		MallocAfter(mallocStartAddr, tid);
+		return;
+	}
+	MemoryArea prevArea = *itr;
+	memorySet.erase(itr);
+	if (mallocStartAddr != 0 && newSize != 0)
+	{
+		memorySet.insert(MemoryArea(tid, mallocStartAddr,
+		                            mallocStartAddr + newSize));
+	}
+	ReleaseLock(&memorySetLock);
 
-	// Realloc gives the same address as previos realloc(or malloc,calloc)
-	if (prevArea.from == mallocStartAddr)
+	if (mallocStartAddr == previousAddress)
 	{
-		//eger yeni yer daha kucuk ise, eskiden bizim olan aradaki yerleri free edelim
-		if (newSize < prevSize)
+		// grown in place keeps its history, the cut tail is gone
+		if (newSize < prevArea.size())
 		{
-			freeMemoryAddress(mallocStartAddr + newSize,
-			                  mallocStartAddr + prevSize, tid);
+			freeMemoryAddress(previousAddress + newSize, prevArea.to, tid);
 		}
 	}
 	else
 	{
-		if (newSize < prevSize)
-		{
-			moveMemoryAddresses(previousAddress, mallocStartAddr, newSize, tid);
-			freeMemoryAddress(previousAddress + newSize,
-			                  previousAddress + prevSize, tid);
-		}
-		else
-		{
-			moveMemoryAddresses(previousAddress, mallocStartAddr, prevSize,
-			                    tid);
-			freeMemoryAddress(previousAddress, previousAddress + prevSize, tid);
-		}
+		// moved: realloc's own copy is the first access of the new block
+		freeMemoryAddress(prevArea.from, prevArea.to, tid);
 	}
-
-	GetLock(&memorySetLock, tid);
-	memorySet.insert(newArea);
-	memorySet.erase(prevArea);
-	ReleaseLock(&memorySetLock);
 }
 
 VOID CallocEnter(CHAR * name, ADDRINT nElements, ADDRINT sizeOfEachElement,
@@ -441,29 +733,36 @@ VOID MallocAfter(ADDRINT mallocStartAddr, THREADID tid)
 	ADDRINT mallocEndAddr = tls->nextMallocSize + mallocStartAddr;
 	tls->nextMallocSize = 0;
 
+	if (mallocStartAddr == 0 || mallocEndAddr == mallocStartAddr)
+	{
+		return;
+	}
+
 	MemoryArea newArea(tid, mallocStartAddr, mallocEndAddr);
 
-	GetLock(&memorySetLock, tid);
+	GetLock(&memorySetLock, tid + 1);
+	// blocks whose free we missed (e.g. freed from inside libc)
 	MemorySetItr overlaps = smallestOverlappingMemoryArea(newArea);
-
-	if (overlaps != memorySet.end())
+	while (overlaps != memorySet.end() && overlaps->from < mallocEndAddr)
 	{
-		// has overlapping elements
+		memorySet.erase(overlaps++);
 	}
-
+	memorySet.insert(newArea);
 	ReleaseLock(&memorySetLock);
 }
 
-VOID FreeEnter(ADDRINT startAddress, THREADID threadid)
+VOID FreeEnter(CHAR * name, ADDRINT startAddress, THREADID tid)
 {
-	GetLock(&memorySetLock, threadid);
-	const MemoryArea area = findMemoryArea(startAddress);
-	ADDRINT freeSize = area.size();
-	memorySet.erase(area);
-	ReleaseLock(&memorySetLock);
-
-	if (freeSize == 0)
+	GetLock(&memorySetLock, tid + 1);
+	MemorySetItr itr = findMemoryArea(startAddress);
+	if (itr == memorySet.end())
+	{
+		ReleaseLock(&memorySetLock);
 		return;
+	}
+	MemoryArea area = *itr;
+	memorySet.erase(itr);
+	ReleaseLock(&memorySetLock);
 
-	freeMemoryAddress(startAddress, area.to, threadid);
+	freeMemoryAddress(area.from, area.to, tid);
 }
@@ -11,10 +11,13 @@
 #include <string.h>
 #include <dlfcn.h>
 #include <map>
+#include <set>
+#include <utility>
 
 #include "GlobalVariables.h"
 #include "MultiCacheSim-dist/MultiCacheSim.h"
-#define MAX_NTHREADS 64
+// pin thread ids, the vector clock slots are recycled separately
+#define MAX_NTHREADS 8192
 
 extern THREADID lastCreatedThread;
 
@@ -27,23 +30,74 @@ extern MemorySet memorySet;
 
 extern bool stopOnError;
 extern bool printOnError;
+extern bool splitInstrumentation;
+extern bool staticElision;
+extern bool elideFramePointer;
 
 extern unsigned long instrumentationStatus[MAX_NTHREADS];
+
+extern UINT64 insertCacheHits;
+extern UINT64 insertCacheMisses;
+
+class StackRange
+{
+public:
+	ADDRINT low;
+	ADDRINT size;
+
+	StackRange() :
+			low(0), size(0)
+	{}
+};
+extern StackRange threadStacks[MAX_NTHREADS];
 enum MemOpType
 {
 	MemRead = 0, MemWrite = 1
 };
 
+class ImageStats
+{
+public:
+	std::string name;
+	std::vector<MemoryArea> readOnlyAreas;
+	unsigned long instrumented;
+	unsigned long elidedStack;
+	unsigned long elidedConstant;
+
+	// operands counted so far (address, operand, write), traces may be
+	// instrumented again
+	std::set<std::pair<ADDRINT, UINT32> > counted;
+
+	ImageStats(const std::string& name) :
+			name(name), instrumented(0), elidedStack(0), elidedConstant(0)
+	{}
+};
+typedef std::map<UINT32, ImageStats*> ImageStatsMap;
+typedef ImageStatsMap::iterator ImageStatsMapItr;
+
 VOID TurnInstrumentationOn(ADDRINT tid);
 VOID TurnInstrumentationOff(ADDRINT tid);
 VOID instrumentMCCRoutine(RTN rtn, VOID *v);
 
-VOID Read(THREADID threadid, ADDRINT effectiveAddr, ADDRINT stackPtr,
-		const char* imageName, ADDRINT insPtr, UINT32 readSize);
-VOID Write(THREADID threadid, ADDRINT effectiveAddr, ADDRINT stackPtr,
-		const char* imageName, ADDRINT insPtr, UINT32 writeSize);
+bool initThreadStack(THREADID tid, ADDRINT stackPtr, ADDRINT* low,
+		ADDRINT* high);
+
+VOID Read(THREADID threadid, ADDRINT effectiveAddr, const char* imageName,
+		ADDRINT insPtr, UINT32 readSize);
+VOID Write(THREADID threadid, ADDRINT effectiveAddr, const char* imageName,
+		ADDRINT insPtr, UINT32 writeSize);
+
+ADDRINT PIN_FAST_ANALYSIS_CALL IsSharedAccess(THREADID tid,
+		ADDRINT effectiveAddr);
+VOID PIN_FAST_ANALYSIS_CALL ReadThen(THREADID tid, ADDRINT effectiveAddr);
+VOID PIN_FAST_ANALYSIS_CALL WriteThen(THREADID tid, ADDRINT effectiveAddr);
+VOID PIN_FAST_ANALYSIS_CALL CheckReadThen(THREADID tid, ADDRINT effectiveAddr,
+		UINT32 size, ADDRINT pc);
+VOID PIN_FAST_ANALYSIS_CALL CheckWriteThen(THREADID tid, ADDRINT effectiveAddr,
+		UINT32 size, ADDRINT pc);
 
 VOID instrumentTrace(TRACE trace, VOID *v);
+void printInstrumentationStats(FILE* out);
 BOOL segvHandler(THREADID threadid, INT32 sig, CONTEXT *ctx, BOOL hasHndlr,
 		const EXCEPTION_INFO *pExceptInfo, VOID*v);
 BOOL termHandler(THREADID threadid, INT32 sig, CONTEXT *ctx, BOOL hasHndlr,
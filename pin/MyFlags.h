@@ -33,4 +33,8 @@
 
 //#define PRINT_SIGNATURES
 
+// when enabled, every signature insert takes rdmLock (the old behaviour, kept
+// to benchmark against the lock-free per-thread accumulation)
+//#define LOCKED_SIGNATURE_INSERT
+
 #endif /* MYDEFINITIONS_H_ */
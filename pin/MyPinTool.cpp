@@ -7,12 +7,16 @@
 #include <list>
 #include <map>
 #include <assert.h>
+#include <new>
 
 #include "GlobalVariables.h"
 #include "SigraceModules.h"
 #include "PthreadInstumentation.h"
 #include "MultiCacheSim_PinDriver.h"
 #include "Bloom.h"
+#include "BloomKernels.h"
+#include "VectorClockKernels.h"
+#include "FastTrack.h"
 
 /* === KNOB DEFINITIONS =================================== */
 
@@ -49,6 +53,77 @@ KNOB<string> KnobProtocol(KNOB_MODE_WRITEONCE, "pintool", "protos",
 		"./MultiCacheSim-dist/MSI_SMPCache.so",
 		"Cache Coherence Protocol Modules To Simulate");
 
+KNOB<bool> KnobSplitInstrumentation(KNOB_MODE_WRITEONCE, "pintool", "split",
+		"true",
+		"Use inlinable if/then analysis routines that only call the signature "
+				"insert for shared accesses");
+
+KNOB<bool> KnobStaticElision(KNOB_MODE_WRITEONCE, "pintool", "elide", "true",
+		"Don't instrument stack accesses and rip-relative reads of read-only "
+				"sections");
+
+KNOB<bool> KnobElideFramePointer(KNOB_MODE_WRITEONCE, "pintool",
+		"elideFramePtr", "false",
+		"Treat rbp based operands as stack accesses (only for code built "
+				"with -fno-omit-frame-pointer, rbp is a general register "
+				"otherwise)");
+
+KNOB<string> KnobBloomKernel(KNOB_MODE_WRITEONCE, "pintool", "bloomKernel",
+		"auto", "Signature kernels to use: auto, byte, word, sse2 or avx2");
+
+KNOB<unsigned int> KnobBloomBits(KNOB_MODE_WRITEONCE, "pintool", "bloomBits",
+		"2048", "Signature size in bits, a power of two");
+
+KNOB<unsigned int> KnobBloomHashes(KNOB_MODE_WRITEONCE, "pintool",
+		"bloomHashes", "0",
+		"Hash functions per signature, 0 to derive it from -bloomExpected");
+
+KNOB<unsigned int> KnobBloomExpected(KNOB_MODE_WRITEONCE, "pintool",
+		"bloomExpected", "256",
+		"Expected number of distinct addresses per epoch and signature");
+
+KNOB<bool> KnobAdaptiveSignatures(KNOB_MODE_WRITEONCE, "pintool",
+		"adaptiveSig", "true",
+		"Size the signatures of each epoch from the footprint of the thread's "
+				"previous epochs");
+
+KNOB<unsigned int> KnobBloomMaxBits(KNOB_MODE_WRITEONCE, "pintool",
+		"bloomMaxBits", "262144",
+		"Largest signature in bits when -adaptiveSig is on, a power of two");
+
+KNOB<string> KnobGranularity(KNOB_MODE_WRITEONCE, "pintool", "granularity",
+		"byte", "Signature granularity: byte, word, line (64 bytes) or page");
+
+KNOB<string> KnobDetector(KNOB_MODE_WRITEONCE, "pintool", "detector",
+		"signature", "Race detector: signature (Bloom signatures compared at "
+				"epoch ends) or fasttrack (exact, per address shadow state)");
+
+KNOB<unsigned int> KnobCheckers(KNOB_MODE_WRITEONCE, "pintool", "checkers",
+		"0", "Internal threads checking the signatures in the background, 0 "
+				"checks them in the application threads");
+
+KNOB<unsigned int> KnobHistoryDepth(KNOB_MODE_WRITEONCE, "pintool",
+		"historyDepth", "16", "Earlier signatures of every other thread a "
+				"signature is checked against");
+
+KNOB<unsigned int> KnobHistoryBudget(KNOB_MODE_WRITEONCE, "pintool",
+		"historyBudget", "0", "Megabytes the kept signatures may take before "
+				"the cheapest are evicted, 0 for no limit");
+
+KNOB<string> KnobEpochFormat(KNOB_MODE_WRITEONCE, "pintool", "epochFormat",
+		"text", "Epoch logs: text (a line of clock components per epoch) or "
+				"binary (delta coded, see epochconvert)");
+
+KNOB<bool> KnobEpochSignatures(KNOB_MODE_WRITEONCE, "pintool",
+		"epochSignatures", "false", "Also log the signatures of the epochs, "
+				"binary epoch logs only");
+
+KNOB<string> KnobClockKernel(KNOB_MODE_WRITEONCE, "pintool", "clockKernel",
+		"auto", "Vector clock kernels to use: auto, scalar, sse41 or avx2");
+
+KNOB<string> KnobStatsFile(KNOB_MODE_WRITEONCE, "pintool", "stats",
+		"tool_stats.txt", "specify file name for the tool statistics");
+
 KNOB<string> KnobCreateFile(KNOB_MODE_WRITEONCE, "pintool", "createFile",
 		"create.txt", "specify create file to order the thread creations");
 
@@ -91,12 +166,12 @@ MemorySet memorySet;
 
 // record-n-replay
 UINT32 globalEventId = -1;
-PIN_LOCK recordLock;
 FILE* recordFile = NULL;
 FILE* raceInfoFile = NULL;
 
 ThreadCreateOrder threadCreateOrder;
 FILE* createFile;
+FILE* statsFile;
 
 // >>> Global storage >>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
@@ -126,18 +201,108 @@ int main(INT32 argc, CHAR **argv)
 	InitLock(&threadIdMapLock);
 	InitLock(&barrierLock);
 	InitLock(&memorySetLock);
-	InitLock(&recordLock);
 	InitLock(&atomicCreate);
 
 	recordFile = fopen("record.txt", "w");
 	raceInfoFile = fopen("race_info.txt", "w");
 	createFile = fopen(KnobCreateFile.Value().c_str(), "w");
+	statsFile = fopen(KnobStatsFile.Value().c_str(), "w");
+
+	if (KnobEpochFormat.Value() == "binary")
+	{
+		EpochLog::binary = true;
+	}
+	else if (KnobEpochFormat.Value() != "text")
+	{
+		fprintf(stderr, "Unknown epoch format %s\n",
+		        KnobEpochFormat.Value().c_str());
+		exit(1);
+	}
+	if (KnobEpochSignatures.Value() && !EpochLog::binary)
+	{
+		fprintf(stderr, "-epochSignatures needs -epochFormat binary\n");
+		exit(1);
+	}
+	EpochLog::signatures = KnobEpochSignatures.Value();
+
+	if (KnobDetector.Value() != "fasttrack" && KnobDetector.Value() != "signature")
+	{
+		fprintf(stderr, "Unknown detector %s\n", KnobDetector.Value().c_str());
+		exit(1);
+	}
+
+	if (KnobCheckers.Value() > MAX_CHECKER_COUNT)
+	{
+		fprintf(stderr, "At most %d checkers are supported\n", MAX_CHECKER_COUNT);
+		exit(1);
+	}
+	rdm.configureCheckers(KnobCheckers.Value());
+	if (KnobHistoryDepth.Value() == 0)
+	{
+		fprintf(stderr, "The history depth must be at least 1\n");
+		exit(1);
+	}
+	rdm.configureHistory(KnobHistoryDepth.Value(),
+	                     (UINT64) KnobHistoryBudget.Value() << 20);
+
+	if (!selectVectorClockKernels(KnobClockKernel.Value().c_str()))
+	{
+		fprintf(stderr, "Vector clock kernels %s are unknown or not supported\n",
+				KnobClockKernel.Value().c_str());
+		exit(1);
+	}
 
 	//waitQueueMap = new WaitQueueMap;
 	unlockedThreadMap = new UnlockThreadMap;
 	notifiedThreadMap = new NotifyThreadMap;
 	tlsKey = PIN_CreateThreadDataKey(0);
 
+	if (!selectBloomKernels(KnobBloomKernel.Value().c_str()))
+	{
+		fprintf(stderr, "Bloom kernels %s are unknown or not supported\n",
+				KnobBloomKernel.Value().c_str());
+		exit(1);
+	}
+
+	if (!configureBloomGeometry(KnobBloomBits.Value(), KnobBloomHashes.Value(),
+			KnobBloomExpected.Value()))
+	{
+		fprintf(stderr, "Invalid signature geometry: -bloomBits must be a power "
+				"of two >= %d and -bloomHashes at most %d\n", BLOOM_WORD_BITS,
+				MAX_BLOOM_HASH_COUNT);
+		exit(1);
+	}
+	if (!configureAdaptiveSignatures(KnobAdaptiveSignatures.Value(),
+			KnobBloomMaxBits.Value()))
+	{
+		fprintf(stderr, "Invalid -bloomMaxBits: must be a power of two >= "
+				"-bloomBits\n");
+		exit(1);
+	}
+	if (!configureSignatureGranularity(KnobGranularity.Value().c_str()))
+	{
+		fprintf(stderr, "Unknown signature granularity %s\n",
+				KnobGranularity.Value().c_str());
+		exit(1);
+	}
+	if (KnobDetector.Value() == "fasttrack")
+	{
+		// after the granularity, the shadow has a word per granule. The lock
+		// stripes are cache line aligned, plain new doesn't do that
+		void* memory = NULL;
+		if (posix_memalign(&memory, 64, sizeof(FastTrackDetector)))
+		{
+			fprintf(stderr, "Couldn't allocate the race detector\n");
+			exit(1);
+		}
+		fastTrack = new (memory) FastTrackDetector(bloomGeometry.granularityShift);
+	}
+
+	fprintf(statsFile, "signatures: %d bits, %d hash functions, adaptive: %s "
+			"(max %d bits), granularity: %lu bytes\n", bloomGeometry.size,
+			bloomGeometry.nfuncs, bloomGeometry.adaptive ? "yes" : "no",
+			bloomGeometry.maxSize, (unsigned long) bloomGeometry.granularity);
+
 	for (int i = 0; i < MAX_NTHREADS; i++)
 	{
 		instrumentationStatus[i] = true;
@@ -209,6 +374,9 @@ int main(INT32 argc, CHAR **argv)
 
 	stopOnError = KnobStopOnError.Value();
 	printOnError = KnobPrintOnError.Value();
+	splitInstrumentation = KnobSplitInstrumentation.Value();
+	staticElision = KnobStaticElision.Value();
+	elideFramePointer = KnobElideFramePointer.Value();
 
 	// Register ImageLoad to be called when each image is loaded.
 	IMG_AddInstrumentFunction(ImageLoad, NULL);
@@ -218,8 +386,11 @@ int main(INT32 argc, CHAR **argv)
 	PIN_AddThreadStartFunction(ThreadStart, 0);
 	PIN_AddThreadFiniFunction(ThreadFini, 0);
 
+	PIN_AddPrepareForFiniFunction(StopCheckers, 0);
 	PIN_AddFiniFunction(Fini, 0);
 
+	startCheckers(KnobCheckers.Value());
+
 	// Never returns
 	PIN_StartProgram();
 
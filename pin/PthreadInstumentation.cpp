@@ -5,6 +5,7 @@
 #include "PthreadInstumentation.h"
 #include "GlobalVariables.h"
 #include "RecordNReplay.h"
+#include "FastTrack.h"
 
 // define the replaced function here for convenience
 enum
@@ -31,8 +32,7 @@ ThreadLocalStorage* getTLS(THREADID tid)
 static void printSignatures(THREADID tid)
 {
 	ThreadLocalStorage* tls = getTLS(tid);
-	EASSERT(tls->out && tls->vectorClock);
-	FILE* out = tls->out;
+	EASSERT(tls->epochLog && tls->vectorClock);
 	VectorClock* vectorClock = tls->vectorClock;
 
 #ifdef DEBUG_MODE
@@ -42,8 +42,8 @@ static void printSignatures(THREADID tid)
 #endif
 
 	// write the vector clock to the logging file of the thread
-	vectorClock->printVector(out);
-	fflush(out);
+	tls->epochLog->write(*vectorClock, *tls->readBloomFilter,
+	                     *tls->writeBloomFilter);
 }
 
 static void printSignatures()
@@ -51,25 +51,110 @@ static void printSignatures()
 	return printSignatures(PIN_ThreadId());
 }
 
+/*
+ * Push the signatures of the current epoch into the history of the thread's
+ * slot, checking them against the other slots, and fold its footprint into the
+ * thread's estimate. No lock is taken.
+ */
+static void takeSignature(THREADID tid, ThreadLocalStorage* tls)
+{
+	// grow with a large epoch at once, shrink slowly after it
+	int footprint = std::max(tls->readBloomFilter->getElementCount(),
+	                         tls->writeBloomFilter->getElementCount());
+	if (footprint > tls->footprintEstimate)
+	{
+		tls->footprintEstimate = footprint;
+	}
+	else
+	{
+		tls->footprintEstimate -= (tls->footprintEstimate - footprint) / 4;
+	}
+
+	rdm.addSignature(tid, *tls->vectorClock, *tls->readBloomFilter,
+	                 *tls->writeBloomFilter);
+}
+
+/*
+ * Clear the signatures for the next epoch, resizing them to the footprint
+ * estimate of the thread
+ */
+static void startEpoch(ThreadLocalStorage* tls)
+{
+	tls->readBloomFilter->clear();
+	tls->writeBloomFilter->clear();
+	tls->readCache.flush();
+	tls->writeCache.flush();
+
+	if (bloomGeometry.adaptive)
+	{
+		int size = Bloom::sizeFor(tls->footprintEstimate);
+		tls->readBloomFilter->resize(size);
+		tls->writeBloomFilter->resize(size);
+	}
+}
+
+/*
+ * Vector clock slots. The slot of a finished thread goes to a new thread whose
+ * parent's clock already covers the finished thread's last value: the new
+ * thread continues the slot's component from there, so everything the old one
+ * did happens before it and the slot behaves like one long thread. Otherwise a
+ * new slot is added, growing the clocks and the history rings. Both are
+ * guarded by threadIdMapLock.
+ */
+static vector<UINT32> slotLastValues;
+static list<UINT32> retiredSlots;
+
+static UINT32 allocateSlot(const VectorClock* parentClock)
+{
+	if (parentClock)
+	{
+		for (list<UINT32>::iterator itr = retiredSlots.begin();
+		        itr != retiredSlots.end(); itr++)
+		{
+			UINT32 slot = *itr;
+			if (parentClock->get(slot) >= slotLastValues[slot])
+			{
+				retiredSlots.erase(itr);
+				return slot;
+			}
+		}
+	}
+
+	UINT32 slot = VectorClock::totalProcessCount++;
+	slotLastValues.push_back(0);
+	rdm.addProcessor();
+
+	return slot;
+}
+
+static void retireSlot(VectorClock* vectorClock)
+{
+	slotLastValues[vectorClock->threadId] = vectorClock->get();
+	retiredSlots.push_back(vectorClock->threadId);
+}
+
 /*
  * Initialize the thread local storage and create the vector clock of the thread
  */
 VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
 {
-	EASSERT_MSG(tid < MAX_THREAD_COUNT,
-	            "Max thread id (%d) is exceeded with %d\n", MAX_THREAD_COUNT, tid);
+	EASSERT_MSG(tid < MAX_NTHREADS,
+	            "Max thread id (%d) is exceeded with %d\n", MAX_NTHREADS, tid);
 
 	GetLock(&threadIdMapLock, tid + 1);
 
 	// log the child-parent information
 	PrintRecordInfo(tid, CREATE);
 
-	rdm.addProcessor();
-
 	// create the thread local storage
 	ThreadLocalStorage* tls = new ThreadLocalStorage();
 	tls->readBloomFilter = new Bloom();
 	tls->writeBloomFilter = new Bloom();
+	tls->footprintEstimate = bloomGeometry.size / bloomGeometry.bitsPerElement;
+
+	// accesses to the thread's own stack don't go into the signatures
+	initThreadStack(tid, PIN_GetContextReg(ctxt, REG_STACK_PTR),
+	                &tls->stackLow, &tls->stackHigh);
 
 	// open the log file
 	string filename = KnobOutputFile.Value() + "." + decstr(tid);
@@ -87,25 +172,26 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
 		ThreadIdMapItr parentTidItr = threadIdMap.find(parentOS_TID);
 		assert(parentTidItr != threadIdMap.end());
 		THREADID parentTID = parentTidItr->second;
+		ThreadLocalStorage* parentTLS = getTLS(parentTID);
+		UINT32 slot = allocateSlot(parentTLS->vectorClock);
 
-		CreateInfo thisThreadInfo(tid, parentTID);
+		CreateInfo thisThreadInfo(tid, parentTID, slot);
 		threadCreateOrder.push_back(thisThreadInfo);
 
-		ThreadLocalStorage* parentTLS = getTLS(parentTID);
-
 		/*
 		 * Since parent thread will advance its vector clock after
 		 * writing the tid to the lastCreatedThread variable, it is
 		 * safe to access the parent's vector clock here
 		 */
-		tls->vectorClock = new VectorClock(*parentTLS->vectorClock, tid);
+		tls->vectorClock = new VectorClock(*parentTLS->vectorClock, slot);
 
 		lastCreatedThread = tid;
 	}
 	else
 	{
-		tls->vectorClock = new VectorClock(tid);
+		tls->vectorClock = new VectorClock(allocateSlot(NULL));
 	}
+	tls->epochLog = new EpochLog(out, tid, tls->vectorClock->threadId);
 
 	// create the log file
 	PIN_SetThreadData(tlsKey, tls, tid);
@@ -116,21 +202,23 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
 // This routine is executed every time a thread is destroyed.
 VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
 {
-	if (recordFile)
-	{
-		fflush(recordFile);
-	}
-
 	ThreadLocalStorage* tls = getTLS(tid);
-	VectorClock* vectorClock = tls->vectorClock;
-	Bloom* readFilter = tls->readBloomFilter;
-	Bloom* writeFilter = tls->writeBloomFilter;
+	takeSignature(tid, tls);
+
+	__sync_fetch_and_add(&insertCacheHits,
+	                     tls->readCache.hits + tls->writeCache.hits);
+	__sync_fetch_and_add(&insertCacheMisses,
+	                     tls->readCache.misses + tls->writeCache.misses);
 
 	// write the last information
-	GetLock(&rdmLock, tid + 1);
 	printSignatures();
-	rdm.addSignature(new SigRaceData(tid, *vectorClock, *readFilter, *writeFilter));
-	ReleaseLock(&rdmLock);
+
+	// deleting the log flushes it, the buffer and the file aren't needed once
+	// the thread is gone
+	delete tls->epochLog;
+	tls->epochLog = NULL;
+	fclose(tls->out);
+	tls->out = NULL;
 
 	// update parent thread's vector clock with the finished child's
 	GetLock(&threadIdMapLock, tid + 1);
@@ -148,6 +236,7 @@ VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
 		ThreadLocalStorage* parentTLS = getTLS(parentTID);
 		parentTLS->joinVCMap[tid] = *tls->vectorClock;
 	}
+	retireSlot(tls->vectorClock);
 
 	ReleaseLock(&threadIdMapLock);
 
@@ -202,20 +291,15 @@ int PthreadCreateReplacement(THREADID tid, CONTEXT *ctxt, AFUNPTR origFunc,
 	ReleaseLock(&threadIdMapLock);
 
 	// write the previous epoch to the module
-	GetLock(&rdmLock, tid + 1);
+	takeSignature(tid, tls);
 	printSignatures();
 #ifdef PRINT_SYNC_FUNCTION
 
 	fprintf(tls->out, "--- PTHREAD CREATE ---\n");
 #endif
-	// add current signature to the rdm
-	rdm.addSignature( new SigRaceData(tid, *tls->vectorClock,
-	                                  *tls->readBloomFilter, *tls->writeBloomFilter));
-	ReleaseLock(&rdmLock);
 
 	// get ready for the next epoch
-	tls->readBloomFilter->clear();
-	tls->writeBloomFilter->clear();
+	startEpoch(tls);
 	tls->vectorClock->advance();
 
 	ReleaseLock(&atomicCreate);
@@ -237,7 +321,7 @@ int PthreadJoinReplacement(THREADID tid, CONTEXT *ctxt, AFUNPTR origFunc,
 	// currently, assume that threads are created without any error
 	EASSERT(rc == 0);
 
-	GetLock(&rdmLock, tid + 1);
+	takeSignature(tid, tls);
 	printSignatures();
 
 #ifdef PRINT_SYNC_FUNCTION
@@ -245,12 +329,7 @@ int PthreadJoinReplacement(THREADID tid, CONTEXT *ctxt, AFUNPTR origFunc,
 	fprintf(tls->out, "--- PTHREAD JOIN ---\n");
 #endif
 
-	// add current signature to the rdm
-	rdm.addSignature(new SigRaceData(tid, *tls->vectorClock,
-	                                 *tls->readBloomFilter, *tls->writeBloomFilter));
-	tls->readBloomFilter->clear();
-	tls->writeBloomFilter->clear();
-	ReleaseLock(&rdmLock);
+	startEpoch(tls);
 
 	GetLock(&threadIdMapLock, tid + 1);
 	PthreadPinIdMapItr itr = pthreadPinIdMap.find(thread);
@@ -295,8 +374,6 @@ VOID AfterLock(THREADID tid, int returnValue)
 	PrintRecordInfo(tid, LOCK);
 
 	VectorClock* vectorClock = tls->vectorClock;
-	Bloom* readFilter = tls->readBloomFilter;
-	Bloom* writeFilter = tls->writeBloomFilter;
 
 #ifdef DEBUG_MODE
 
@@ -304,12 +381,10 @@ VOID AfterLock(THREADID tid, int returnValue)
 	fflush(stdout);
 #endif
 
+	takeSignature(tid, tls);
 	GetLock(&rdmLock, tid + 1);
 
 	printSignatures();
-	// add signature to the rdm
-	rdm.addSignature(
-	    new SigRaceData(tid, *vectorClock, *readFilter, *writeFilter));
 
 #ifdef PRINT_SYNC_FUNCTION
 
@@ -337,8 +412,7 @@ VOID AfterLock(THREADID tid, int returnValue)
 
 	ReleaseLock(&rdmLock);
 
-	readFilter->clear();
-	writeFilter->clear();
+	startEpoch(tls);
 }
 
 VOID AfterTryLock(THREADID tid, int returnValue)
@@ -361,8 +435,6 @@ VOID BeforeUnlock(THREADID tid, ADDRINT lockAddr)
 
 	ThreadLocalStorage* tls = getTLS(tid);
 	VectorClock* vectorClock = tls->vectorClock;
-	Bloom* readFilter = tls->readBloomFilter;
-	Bloom* writeFilter = tls->writeBloomFilter;
 
 #ifdef DEBUG_MODE
 
@@ -370,12 +442,10 @@ VOID BeforeUnlock(THREADID tid, ADDRINT lockAddr)
 	fflush(stdout);
 #endif
 
+	takeSignature(tid, tls);
 	GetLock(&rdmLock, tid + 1);
 
 	printSignatures();
-	// add current signature to the rdm
-	rdm.addSignature(
-	    new SigRaceData(tid, *vectorClock, *readFilter, *writeFilter));
 
 #ifdef PRINT_SYNC_FUNCTION
 
@@ -390,16 +460,13 @@ VOID BeforeUnlock(THREADID tid, ADDRINT lockAddr)
 
 	ReleaseLock(&rdmLock);
 
-	readFilter->clear();
-	writeFilter->clear();
+	startEpoch(tls);
 }
 
 VOID BeforeCondWait(THREADID tid, ADDRINT condVarAddr, ADDRINT lockAddr)
 {
 	ThreadLocalStorage* tls = getTLS(tid);
 	VectorClock* vectorClock = tls->vectorClock;
-	Bloom* readFilter = tls->readBloomFilter;
-	Bloom* writeFilter = tls->writeBloomFilter;
 
 	tls->lockAddr = lockAddr;
 	tls->condVarAddr = condVarAddr;
@@ -419,12 +486,10 @@ VOID BeforeCondWait(THREADID tid, ADDRINT condVarAddr, ADDRINT lockAddr)
 	fflush(stdout);
 #endif
 
+	takeSignature(tid, tls);
 	GetLock(&rdmLock, tid + 1);
 
 	printSignatures();
-	// add current signature to the rdm
-	rdm.addSignature(
-	    new SigRaceData(tid, *vectorClock, *readFilter, *writeFilter));
 
 #ifdef PRINT_SYNC_FUNCTION
 
@@ -439,8 +504,7 @@ VOID BeforeCondWait(THREADID tid, ADDRINT condVarAddr, ADDRINT lockAddr)
 
 	ReleaseLock(&rdmLock);
 
-	readFilter->clear();
-	writeFilter->clear();
+	startEpoch(tls);
 }
 
 VOID AfterCondWait(THREADID tid, int returnValue)
@@ -457,8 +521,6 @@ VOID AfterCondWait(THREADID tid, int returnValue)
 	PrintRecordInfo(tid, COND_WAIT);
 
 	VectorClock* vectorClock = tls->vectorClock;
-	Bloom* readFilter = tls->readBloomFilter;
-	Bloom* writeFilter = tls->writeBloomFilter;
 
 #ifdef DEBUG_MODE
 
@@ -491,8 +553,7 @@ VOID AfterCondWait(THREADID tid, int returnValue)
 
 	ReleaseLock(&rdmLock);
 
-	readFilter->clear();
-	writeFilter->clear();
+	startEpoch(tls);
 }
 
 VOID BeforeBarrierInit(THREADID tid, ADDRINT barrier, ADDRINT barrierAttr, int size)
@@ -542,11 +603,9 @@ VOID BeforeBarrierWait(THREADID tid, ADDRINT barrier)
 	}
 	EASSERT(barrierData);
 
-	printSignatures();
 	// add current signature to the rdm
-	rdm.addSignature(
-	    new SigRaceData(tid, *(tls->vectorClock), *(tls->readBloomFilter),
-	                    *(tls->writeBloomFilter)));
+	takeSignature(tid, tls);
+	printSignatures();
 
 #ifdef PRINT_SYNC_FUNCTION
 
@@ -579,8 +638,7 @@ VOID BeforeBarrierWait(THREADID tid, ADDRINT barrier)
 
 	ReleaseLock(&barrierLock);
 
-	tls->readBloomFilter->clear();
-	tls->writeBloomFilter->clear();
+	startEpoch(tls);
 
 }
 
@@ -632,8 +690,6 @@ VOID BeforeCondSignal(THREADID tid, ADDRINT condVarAddr)
 
 	ThreadLocalStorage* tls = getTLS(tid);
 	VectorClock* vectorClock = tls->vectorClock;
-	Bloom* readFilter = tls->readBloomFilter;
-	Bloom* writeFilter = tls->writeBloomFilter;
 
 #ifdef DEBUG_MODE
 
@@ -642,12 +698,10 @@ VOID BeforeCondSignal(THREADID tid, ADDRINT condVarAddr)
 	fflush(stdout);
 #endif
 
+	takeSignature(tid, tls);
 	GetLock(&rdmLock, tid + 1);
 
 	printSignatures();
-	// add current signature to the rdm
-	rdm.addSignature(
-	    new SigRaceData(tid, *vectorClock, *readFilter, *writeFilter));
 
 #ifdef PRINT_SYNC_FUNCTION
 
@@ -662,8 +716,7 @@ VOID BeforeCondSignal(THREADID tid, ADDRINT condVarAddr)
 
 	ReleaseLock(&rdmLock);
 
-	readFilter->clear();
-	writeFilter->clear();
+	startEpoch(tls);
 }
 
 VOID BeforeCondBroadcast(THREADID tid, ADDRINT condVarAddr)
@@ -765,6 +818,59 @@ replaceSignature(IMG img, const char* originalFunctionName,
 }
 
 // This routine is executed for each image.
+/*
+ * The heap of the application, for the FastTrack detector to drop the shadow
+ * of freed blocks
+ */
+static void instrumentAllocator(IMG img)
+{
+	RTN rtn = RTN_FindByName(img, "malloc");
+	if (RTN_Valid(rtn))
+	{
+		RTN_Open(rtn);
+		RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) MallocEnter,
+		               IARG_PTR, "malloc", IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+		               IARG_THREAD_ID, IARG_END);
+		RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR) MallocAfter,
+		               IARG_FUNCRET_EXITPOINT_VALUE, IARG_THREAD_ID, IARG_END);
+		RTN_Close(rtn);
+	}
+
+	rtn = RTN_FindByName(img, "calloc");
+	if (RTN_Valid(rtn))
+	{
+		RTN_Open(rtn);
+		RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) CallocEnter,
+		               IARG_PTR, "calloc", IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+		               IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_THREAD_ID, IARG_END);
+		RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR) MallocAfter,
+		               IARG_FUNCRET_EXITPOINT_VALUE, IARG_THREAD_ID, IARG_END);
+		RTN_Close(rtn);
+	}
+
+	rtn = RTN_FindByName(img, "realloc");
+	if (RTN_Valid(rtn))
+	{
+		RTN_Open(rtn);
+		RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) ReallocEnter,
+		               IARG_PTR, "realloc", IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+		               IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_THREAD_ID, IARG_END);
+		RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR) ReallocAfter,
+		               IARG_FUNCRET_EXITPOINT_VALUE, IARG_THREAD_ID, IARG_END);
+		RTN_Close(rtn);
+	}
+
+	rtn = RTN_FindByName(img, "free");
+	if (RTN_Valid(rtn))
+	{
+		RTN_Open(rtn);
+		RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR) FreeEnter,
+		               IARG_PTR, "free", IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+		               IARG_THREAD_ID, IARG_END);
+		RTN_Close(rtn);
+	}
+}
+
 VOID ImageLoad(IMG img, VOID *)
 {
 	RTN rtn = RTN_FindByName(img, "INSTRUMENT_OFF");
@@ -827,6 +933,68 @@ VOID ImageLoad(IMG img, VOID *)
 		addInstrumentation(img, "pthread_barrier_wait", INSTRUMENT_BOTH, 1,
 		                   AFUNPTR(BeforeBarrierWait), AFUNPTR(AfterBarrierWait));
 	}
+
+	if (fastTrack && IMG_Name(img).find("libc.so") != string::npos)
+	{
+		instrumentAllocator(img);
+	}
+}
+
+/*
+ * Checker threads. They poll the check queue, yielding while it's empty and
+ * sleeping once it stayed empty for a while
+ */
+#define CHECKER_SPIN_COUNT 1000
+
+static vector<PIN_THREAD_UID> checkerThreads;
+static volatile bool stopChecking = false;
+
+static VOID CheckerThread(VOID* arg)
+{
+	volatile UINT64* scanEpoch = rdm.checkerEpoch((int) (ADDRINT) arg);
+	int idle = 0;
+
+	while (!stopChecking)
+	{
+		if (rdm.checkNext(scanEpoch))
+		{
+			idle = 0;
+		}
+		else if (++idle < CHECKER_SPIN_COUNT)
+		{
+			PIN_Yield();
+		}
+		else
+		{
+			PIN_Sleep(1);
+		}
+	}
+}
+
+void startCheckers(int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		PIN_THREAD_UID uid;
+		if (PIN_SpawnInternalThread(CheckerThread, (VOID*) (ADDRINT) i, 0,
+		                            &uid) == INVALID_THREADID)
+		{
+			fprintf(stderr, "Couldn't start checker thread %d\n", i);
+			exit(1);
+		}
+		checkerThreads.push_back(uid);
+	}
+}
+
+// the queued checks left are run in Fini
+VOID StopCheckers(VOID *v)
+{
+	stopChecking = true;
+	for (size_t i = 0; i < checkerThreads.size(); i++)
+	{
+		PIN_WaitForThreadTermination(checkerThreads[i], PIN_INFINITE_TIMEOUT,
+		                             NULL);
+	}
 }
 
 VOID Fini(INT32 code, VOID *v)
@@ -838,7 +1006,26 @@ VOID Fini(INT32 code, VOID *v)
 	for(; itr != end; itr++)
 	{
 		CreateInfo ci = *itr;
-		fprintf(createFile, "%d %d\n", ci.tid, ci.parent);
+		fprintf(createFile, "%d %d %d\n", ci.tid, ci.parent, ci.slot);
 	}
 	fclose(createFile);
+
+	MergeRecordInfo();
+	fclose(recordFile);
+
+	rdm.finishChecks(stderr, raceInfoFile);
+	fclose(raceInfoFile);
+
+	printInstrumentationStats(statsFile);
+	rdm.printStats(statsFile);
+	if (fastTrack)
+	{
+		fastTrack->printStats(statsFile);
+	}
+	fprintf(statsFile, "# threads vector-clock-slots signature-records\n");
+	fprintf(statsFile, "%lu %d %llu\n",
+	        (unsigned long) threadCreateOrder.size() + 1,
+	        VectorClock::totalProcessCount,
+	        (unsigned long long) rdm.getRecordCount());
+	fclose(statsFile);
 }
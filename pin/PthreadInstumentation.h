@@ -38,11 +38,24 @@ extern KNOB<unsigned int> KnobAssoc;
 extern KNOB<unsigned int> KnobNumCaches;
 extern KNOB<string> KnobProtocol;
 extern KNOB<string> KnobReference;
+extern KNOB<bool> KnobSplitInstrumentation;
+extern KNOB<bool> KnobStaticElision;
+extern KNOB<bool> KnobElideFramePointer;
+extern KNOB<string> KnobBloomKernel;
+extern KNOB<unsigned int> KnobBloomBits;
+extern KNOB<unsigned int> KnobBloomHashes;
+extern KNOB<unsigned int> KnobBloomExpected;
+extern KNOB<bool> KnobAdaptiveSignatures;
+extern KNOB<unsigned int> KnobBloomMaxBits;
+extern KNOB<string> KnobGranularity;
+extern KNOB<string> KnobClockKernel;
+extern KNOB<string> KnobDetector;
 
 // variables to handle the order of thread creation
 extern THREADID lastParent;
 extern int createdThreadCount;
 extern FILE* createFile;
+extern FILE* statsFile;
 
 // used to define the point of instrumentation
 #define INSTRUMENT_BEFORE 1
@@ -110,4 +123,8 @@ VOID AfterBarrierWait(THREADID tid, int returnValue);
 
 VOID Fini(INT32 code, VOID *v);
 
+// internal threads draining the signature checks of the rdm
+void startCheckers(int count);
+VOID StopCheckers(VOID *v);
+
 #endif
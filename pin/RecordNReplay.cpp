@@ -3,21 +3,156 @@
  *
  *  Created on: Dec 27, 2013
  *      Author: gokhan
+ *
+ * The events are numbered from an atomic counter and kept by each thread in
+ * its own buffer, written out to record.txt.<tid> whenever it fills up. At
+ * the end the threads' events, each already in order, are merged by number
+ * into record.txt.
  */
 
 #include "pin.H"
 #include "RecordNReplay.h"
+#include "MultiCacheSim_PinDriver.h"
 
 #include <stdio.h>
 #include <assert.h>
+#include <queue>
+#include <functional>
+
+#define RECORD_BUFFER_SIZE 4096
+
+class RecordEntry
+{
+public:
+	UINT32 eventId;
+	UINT32 type;
+};
+
+class RecordBuffer
+{
+public:
+	RecordEntry entries[RECORD_BUFFER_SIZE];
+	UINT32 count;
+	UINT32 next; // while merging
+	FILE* spill; // the full buffers, NULL until the first one
+	string spillName;
+
+	RecordBuffer() :
+			count(0), next(0), spill(NULL)
+	{}
+};
+
+// only the thread itself touches its buffer until the merge
+static RecordBuffer* recordBuffers[MAX_NTHREADS];
+
+static void spillRecords(RecordBuffer* buffer, THREADID tid)
+{
+	if (!buffer->spill)
+	{
+		buffer->spillName = "record.txt." + decstr(tid);
+		buffer->spill = fopen(buffer->spillName.c_str(), "w+b");
+		if (!buffer->spill)
+		{
+			fprintf(stderr, "Couldn't create %s\n", buffer->spillName.c_str());
+			exit(1);
+		}
+	}
+	fwrite(buffer->entries, sizeof(RecordEntry), buffer->count, buffer->spill);
+	buffer->count = 0;
+}
 
 VOID PrintRecordInfo(THREADID tid, OperationType type)
 {
-	GetLock(&recordLock, tid + 1);
+	RecordBuffer* buffer = recordBuffers[tid];
+	if (!buffer)
+	{
+		buffer = recordBuffers[tid] = new RecordBuffer();
+	}
+
+	RecordEntry& entry = buffer->entries[buffer->count++];
+	entry.eventId = __sync_add_and_fetch(&globalEventId, 1);
+	entry.type = type;
 
-	UINT32 eventId = ++globalEventId;
+	if (buffer->count == RECORD_BUFFER_SIZE)
+	{
+		spillRecords(buffer, tid);
+	}
+}
+
+// the next entry of the thread in the merge, false once they are all taken
+static bool nextRecord(RecordBuffer* buffer)
+{
+	if (++buffer->next < buffer->count)
+	{
+		return true;
+	}
+	if (!buffer->spill)
+	{
+		return false;
+	}
+	buffer->count = fread(buffer->entries, sizeof(RecordEntry),
+	                      RECORD_BUFFER_SIZE, buffer->spill);
+	buffer->next = 0;
+	return buffer->count > 0;
+}
+
+VOID MergeRecordInfo()
+{
 	assert(recordFile);
-	fprintf(recordFile, "%d %d %d\n", eventId, tid, type);
 
-	ReleaseLock(&recordLock);
+	// (event id, thread) of the first entry left of every thread
+	typedef std::pair<UINT32, THREADID> Head;
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+
+	for (THREADID tid = 0; tid < MAX_NTHREADS; tid++)
+	{
+		RecordBuffer* buffer = recordBuffers[tid];
+		if (!buffer)
+		{
+			continue;
+		}
+
+		// read the thread's events back from the start of its file
+		if (buffer->spill)
+		{
+			spillRecords(buffer, tid);
+			rewind(buffer->spill);
+			buffer->next = (UINT32) -1;
+			if (!nextRecord(buffer))
+			{
+				continue;
+			}
+		}
+		if (buffer->next < buffer->count)
+		{
+			heads.push(Head(buffer->entries[buffer->next].eventId, tid));
+		}
+	}
+
+	while (!heads.empty())
+	{
+		THREADID tid = heads.top().second;
+		heads.pop();
+
+		RecordBuffer* buffer = recordBuffers[tid];
+		RecordEntry& entry = buffer->entries[buffer->next];
+		fprintf(recordFile, "%d %d %d\n", entry.eventId, tid, entry.type);
+		if (nextRecord(buffer))
+		{
+			heads.push(Head(buffer->entries[buffer->next].eventId, tid));
+		}
+	}
+	fflush(recordFile);
+
+	for (THREADID tid = 0; tid < MAX_NTHREADS; tid++)
+	{
+		RecordBuffer* buffer = recordBuffers[tid];
+		if (buffer && buffer->spill)
+		{
+			fclose(buffer->spill);
+			remove(buffer->spillName.c_str());
+		}
+		delete buffer;
+		recordBuffers[tid] = NULL;
+	}
 }
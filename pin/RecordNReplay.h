@@ -11,8 +11,13 @@
 #include "pin.H"
 
 extern UINT32 globalEventId;
-extern PIN_LOCK recordLock;
 extern FILE* recordFile;
+/*
+ * The races found, a line "tid slot clock other-tid other-slot other-clock"
+ * for each. A side is the epoch of the thread tid: the slot of its clock and
+ * that component, as in its thread_epochs log. Read by the races mode of the
+ * replay tool.
+ */
 extern FILE* raceInfoFile;
 
 typedef enum
@@ -25,9 +30,10 @@ class CreateInfo
 public:
 	THREADID tid;
 	THREADID parent;
+	UINT32 slot; // vector clock slot of the thread
 
-	CreateInfo(THREADID tid, THREADID parent) :
-			tid(tid), parent(parent)
+	CreateInfo(THREADID tid, THREADID parent, UINT32 slot) :
+			tid(tid), parent(parent), slot(slot)
 	{
 	}
 
@@ -48,6 +54,10 @@ typedef ThreadIdMap::iterator ThreadIdMapItr;
 
 #endif
 
+// numbers the event and keeps it in the buffer of the thread, no lock
 VOID PrintRecordInfo(THREADID tid, OperationType type);
 
+// writes all the events into recordFile in order, at the end
+VOID MergeRecordInfo();
+
 #endif /* RECORDNREPLAY_H_ */
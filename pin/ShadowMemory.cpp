@@ -0,0 +1,192 @@
+/*
+ * ShadowMemory.cpp
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+
+#include "ShadowMemory.h"
+
+static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+static inline char* pageDown(const void* p)
+{
+	return (char*) ((ADDRINT) p & ~(ADDRINT) (pageSize - 1));
+}
+
+static inline char* pageUp(const void* p)
+{
+	return pageDown((const char*) p + pageSize - 1);
+}
+
+static void* reserve(size_t bytes)
+{
+	void* memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+	                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		fprintf(stderr, "Couldn't reserve %lu bytes of shadow memory\n",
+		        (unsigned long) bytes);
+		exit(1);
+	}
+	return memory;
+}
+
+// residency of the pages of [begin, end), false if mincore fails
+static bool residentPages(const char* begin, const char* end,
+                          std::vector<unsigned char>& resident)
+{
+	char* first = pageDown(begin);
+	size_t pages = (pageUp(end) - first) / pageSize;
+	resident.assign(pages, 0);
+	return pages == 0 || mincore(first, pages * pageSize, &resident[0]) == 0;
+}
+
+ShadowMemory::ShadowMemory(unsigned granularityShift) :
+		granularityShift(granularityShift),
+		leafBytes((((size_t) 1 << SHADOW_LEAF_BITS) >> granularityShift) *
+		          sizeof(ShadowWord)), leafCount(0), releasedBytes(0)
+{
+	top = (ShadowWord**) reserve(SHADOW_TOP_SIZE * sizeof(ShadowWord*));
+}
+
+ShadowWord* ShadowMemory::allocateLeaf(ADDRINT addr)
+{
+	ShadowWord** entry = &top[(addr >> SHADOW_LEAF_BITS) & (SHADOW_TOP_SIZE - 1)];
+	ShadowWord* leaf = (ShadowWord*) reserve(leafBytes);
+
+	if (!__sync_bool_compare_and_swap(entry, (ShadowWord*) NULL, leaf))
+	{
+		// another thread installed one first
+		munmap(leaf, leafBytes);
+		return *entry;
+	}
+
+	__sync_fetch_and_add(&leafCount, 1);
+	return leaf;
+}
+
+void ShadowMemory::release(ADDRINT from, ADDRINT to)
+{
+	ADDRINT granule = (ADDRINT) 1 << granularityShift;
+	ADDRINT first = (from + granule - 1) & ~(granule - 1);
+	ADDRINT last = to & ~(granule - 1);
+
+	while (first < last)
+	{
+		ADDRINT end = std::min(last, (first | SHADOW_LEAF_MASK) + 1);
+		ShadowWord* leaf = top[(first >> SHADOW_LEAF_BITS) & (SHADOW_TOP_SIZE - 1)];
+		if (leaf)
+		{
+			ShadowWord* word = leaf + ((first & SHADOW_LEAF_MASK) >> granularityShift);
+			releaseInLeaf(word, word + ((end - first) >> granularityShift));
+		}
+		first = end;
+	}
+}
+
+/*
+ * Free the read clocks and zero the words. Pages that were never touched are
+ * skipped (and not brought in), the ones wholly inside are given back.
+ */
+void ShadowMemory::releaseInLeaf(ShadowWord* first, ShadowWord* last)
+{
+	char* begin = (char*) first;
+	char* end = (char*) last;
+	char* base = pageDown(begin);
+
+	std::vector<unsigned char> resident;
+	if (!residentPages(begin, end, resident))
+	{
+		return;
+	}
+
+	const size_t clockOffset = offsetof(ShadowWord, readClock);
+	ShadowWord* word = first;
+	while (word < last)
+	{
+		size_t page = ((char*) &word->readClock - base) / pageSize;
+		if (resident[page] & 1)
+		{
+			delete word->readClock;
+			word++;
+			continue;
+		}
+
+		// jump to the first word whose clock is on the next page
+		char* next = base + (page + 1) * pageSize;
+		word = first + (next - clockOffset - begin + sizeof(ShadowWord) - 1) /
+		       sizeof(ShadowWord);
+	}
+
+	char* innerBegin = pageUp(begin);
+	char* innerEnd = pageDown(end);
+	if (innerBegin >= innerEnd)
+	{
+		if (resident[0] & 1 || resident[resident.size() - 1] & 1)
+		{
+			memset(begin, 0, end - begin);
+		}
+		return;
+	}
+
+	if (begin < innerBegin && (resident[0] & 1))
+	{
+		memset(begin, 0, innerBegin - begin);
+	}
+	if (innerEnd < end && (resident[resident.size() - 1] & 1))
+	{
+		memset(innerEnd, 0, end - innerEnd);
+	}
+	madvise(innerBegin, innerEnd - innerBegin, MADV_DONTNEED);
+	__sync_fetch_and_add(&releasedBytes, (UINT64) (innerEnd - innerBegin));
+}
+
+void ShadowMemory::printStats(FILE* out)
+{
+	char* topBegin = (char*) top;
+	char* topEnd = (char*) (top + SHADOW_TOP_SIZE);
+	UINT64 residentBytes = 0;
+
+	// only the resident pages of the top level can point to leaves
+	std::vector<unsigned char> topResident, leafResident;
+	if (residentPages(topBegin, topEnd, topResident))
+	{
+		for (size_t page = 0; page < topResident.size(); page++)
+		{
+			if (!(topResident[page] & 1))
+			{
+				continue;
+			}
+			residentBytes += pageSize;
+
+			ShadowWord** entry = (ShadowWord**) (topBegin + page * pageSize);
+			ShadowWord** entryEnd = entry + pageSize / sizeof(ShadowWord*);
+			for (; entry < entryEnd; entry++)
+			{
+				if (!*entry || !residentPages((char*) *entry,
+				                              (char*) *entry + leafBytes, leafResident))
+				{
+					continue;
+				}
+				for (size_t i = 0; i < leafResident.size(); i++)
+				{
+					residentBytes += (leafResident[i] & 1) ? pageSize : 0;
+				}
+			}
+		}
+	}
+
+	fprintf(out, "# shadow memory\n");
+	fprintf(out, "# leaves reserved-bytes resident-bytes released-bytes\n");
+	fprintf(out, "%u %llu %llu %llu\n", leafCount,
+	        (unsigned long long) (leafCount * (UINT64) leafBytes),
+	        (unsigned long long) residentBytes,
+	        (unsigned long long) releasedBytes);
+	fflush(out);
+}
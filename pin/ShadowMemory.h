@@ -0,0 +1,90 @@
+/*
+ * ShadowMemory.h
+ *
+ * Direct-mapped two-level shadow table of the FastTrack detector: the top
+ * level has a pointer for every SHADOW_LEAF_BITS sized region of the address
+ * space, the leaf has a ShadowWord for every granule (see -granularity) of
+ * the region. Both are reserved with mmap(MAP_NORESERVE), so the kernel only
+ * backs the pages of the shadow that are touched, and the pages of freed
+ * blocks are given back with madvise.
+ *
+ * Finding the shadow of an address is a shift, a mask and a load. Leaves are
+ * installed with a compare and swap, no lock is taken.
+ */
+
+#ifndef SHADOWMEMORY_H_
+#define SHADOWMEMORY_H_
+
+#include "pin.H"
+
+#include <stdio.h>
+
+#include "VectorClock.h"
+
+// application bytes covered by a leaf
+#define SHADOW_LEAF_BITS    24
+#define SHADOW_LEAF_MASK    ((((ADDRINT) 1) << SHADOW_LEAF_BITS) - 1)
+// user space of x86-64
+#define SHADOW_ADDRESS_BITS 47
+#define SHADOW_TOP_SIZE     (((ADDRINT) 1) << (SHADOW_ADDRESS_BITS - SHADOW_LEAF_BITS))
+
+/*
+ * An epoch c@t is the value c of the component of slot t, the clock of thread
+ * t when it did the access. Zero is the empty epoch, thread clocks start at 1.
+ */
+typedef UINT64 Epoch;
+#define EPOCH(slot, clock) (((Epoch) (slot) << 32) | (clock))
+#define EPOCH_SLOT(epoch)  ((UINT32) ((epoch) >> 32))
+#define EPOCH_CLOCK(epoch) ((UINT32) (epoch))
+#define EMPTY_EPOCH        ((Epoch) 0)
+
+// all zero is a granule nobody accessed, that's what fresh pages hold
+class ShadowWord
+{
+public:
+	Epoch write;
+	Epoch read;
+	VectorClock* readClock; // read concurrently, read is then the last reader
+
+	// for the reports
+	THREADID writeTid;
+	ADDRINT writePc;
+	THREADID readTid;
+	ADDRINT readPc;
+};
+
+class ShadowMemory
+{
+public:
+	ShadowMemory(unsigned granularityShift);
+
+	ShadowWord* lookup(ADDRINT addr)
+	{
+		ShadowWord* leaf = top[(addr >> SHADOW_LEAF_BITS) & (SHADOW_TOP_SIZE - 1)];
+		if (!leaf)
+		{
+			leaf = allocateLeaf(addr);
+		}
+		return leaf + ((addr & SHADOW_LEAF_MASK) >> granularityShift);
+	}
+
+	/*
+	 * Forget the granules wholly inside [from, to), the block was freed. The
+	 * application doesn't touch a block while freeing it, so no lock is taken.
+	 */
+	void release(ADDRINT from, ADDRINT to);
+
+	void printStats(FILE* out);
+
+private:
+	ShadowWord* allocateLeaf(ADDRINT addr);
+	void releaseInLeaf(ShadowWord* first, ShadowWord* last);
+
+	ShadowWord** top;
+	unsigned granularityShift;
+	size_t leafBytes;
+	UINT32 leafCount;
+	UINT64 releasedBytes;
+};
+
+#endif /* SHADOWMEMORY_H_ */
@@ -6,8 +6,15 @@
 #include <iostream>
 #include <iterator>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <list>
 #include <map>
+#include <deque>
+#include <vector>
+#include <new>
+#include <string>
+#include <algorithm>
 #include <assert.h>
 
 #include "Bloom.h"
@@ -16,8 +23,17 @@
 #include "MyFlags.h"
 
 #define NO_ID ((UINT32) 0xFFFFFFFF)
-#define BLOCK_HISTORY_QUEUE_SIZE 16
-#define MAX_THREAD_COUNT 32
+// a signature is checked against this many earlier ones of every other
+// slot, see -historyDepth
+#define DEFAULT_HISTORY_DEPTH 16
+#define CHECK_QUEUE_SIZE 1024
+#define MAX_CHECKER_COUNT 64
+// one in this many records leaving a ring is checked for the statistics
+#define CONCURRENCY_SAMPLE 64
+// a line of race_info.txt, six numbers
+#define RACE_EPOCHS_SIZE 72
+// no more slots than live threads, see MAX_NTHREADS
+#define MAX_CLOCK_SLOTS 8192
 
 extern PIN_LOCK fileLock;
 extern PIN_LOCK rdmLock;
@@ -48,7 +64,6 @@ public:
 
 	ThreadInfo& operator=(const ThreadInfo& other)
 	{
-		ThreadInfo temp(other);
 		tid = other.tid;
 		vectorClock = other.vectorClock;
 
@@ -98,10 +113,43 @@ typedef BarrierMap::iterator BarrierMapItr;
 class SigRaceData
 {
 public:
-	SigRaceData(int tid, VectorClock& ts, Bloom& r, Bloom& w) :
-			tid(tid), ts(ts), r(r), w(w)
+	SigRaceData() :
+			tid(0), slot(0), sequence(0), order(0), retiredAt(0), bytes(0)
 	{}
 
+	// reuses the storage of the clock and the filters
+	void assign(int tid, const VectorClock& ts, const Bloom& r, const Bloom& w)
+	{
+		this->tid = tid;
+		slot = ts.threadId;
+		this->ts = ts;
+		this->r = r;
+		this->w = w;
+		bytes = sizeof(SigRaceData) + this->ts.getHeapBytes() +
+		        this->r.getHeapBytes() + this->w.getHeapBytes();
+	}
+
+	/*
+	 * Which of two records to evict first: the ones without writes (they
+	 * can only race with writes), then the smaller ones, then the older
+	 */
+	bool evictBefore(const SigRaceData& rhs) const
+	{
+		bool writes = w.getElementCount() > 0;
+		bool rhsWrites = rhs.w.getElementCount() > 0;
+		if (writes != rhsWrites)
+		{
+			return !writes;
+		}
+		int elements = r.getElementCount() + w.getElementCount();
+		int rhsElements = rhs.r.getElementCount() + rhs.w.getElementCount();
+		if (elements != rhsElements)
+		{
+			return elements < rhsElements;
+		}
+		return sequence < rhs.sequence;
+	}
+
 	bool operator<(const SigRaceData& rhs)
 	{
 		return ts.happensBefore(rhs.ts);
@@ -112,148 +160,816 @@ public:
 		return ts.isConcurrent(rhs.ts);
 	}
 
-	bool isDirty()
+	// BLOOM_CONFLICT_* mask, RW meaning this one read what rhs wrote
+	unsigned conflictsWith(const SigRaceData& rhs) const
 	{
-		return !r.isEmpty() || !w.isEmpty();
+		return Bloom::conflicts(r, w, rhs.r, rhs.w);
 	}
 
 	UINT32 tid;
+	UINT32 slot; // clock slot of the thread, indexes the history rings
+	UINT64 sequence; // position in the history of the slot
+	UINT64 order; // position among the signatures of all the slots
+	UINT64 retiredAt; // reclamation epoch it left the ring in
+	UINT32 bytes; // counted against the history budget while in the ring
 	VectorClock ts;
 	Bloom r;
 	Bloom w;
 };
 
+/*
+ * The last size signatures of a clock slot, the one with sequence n at
+ * records[n % size] (NULL once evicted). Only the thread holding the slot
+ * pushes and takes from its pool, any thread scans it, evicts from it (see
+ * evictOverBudget) and retires into its own ring.
+ *
+ * orders and clocks index the records by their global order and by the
+ * slot's own component of their clock. Both only grow along the ring, so a
+ * scan binary searches them instead of loading every record.
+ */
+class SignatureRing
+{
+public:
+	SignatureRing(UINT32 size) :
+			size(size), count(0), scanEpoch(0), bytes(0)
+	{
+		records = (SigRaceData* volatile*) calloc(size, sizeof(SigRaceData*));
+		orders = (volatile UINT64*) calloc(size, sizeof(UINT64));
+		clocks = (volatile UINT32*) calloc(size, sizeof(UINT32));
+		if (!records || !orders || !clocks)
+		{
+			fprintf(stderr, "Couldn't allocate a signature history\n");
+			exit(1);
+		}
+	}
+	~SignatureRing()
+	{
+		free((void*) records);
+		free((void*) orders);
+		free((void*) clocks);
+	}
+
+	// first of the sequences [from, to) whose order is above order
+	UINT64 firstAfter(UINT64 from, UINT64 to, UINT64 order) const
+	{
+		while (from < to)
+		{
+			UINT64 middle = from + (to - from) / 2;
+			if (orders[middle % size] > order)
+			{
+				to = middle;
+			}
+			else
+			{
+				from = middle + 1;
+			}
+		}
+		return from;
+	}
+
+	// first of the sequences [from, to) whose own component is at least clock
+	UINT64 firstFrom(UINT64 from, UINT64 to, UINT32 clock) const
+	{
+		while (from < to)
+		{
+			UINT64 middle = from + (to - from) / 2;
+			if (clocks[middle % size] >= clock)
+			{
+				to = middle;
+			}
+			else
+			{
+				from = middle + 1;
+			}
+		}
+		return from;
+	}
+
+	UINT32 size;
+	SigRaceData* volatile* records;
+	volatile UINT64* orders;
+	volatile UINT32* clocks;
+	volatile UINT64 count; // signatures pushed so far
+	volatile UINT64 scanEpoch; // of the owner's running scan, 0 if none
+	volatile UINT64 bytes; // of its records, see storedBytes
+
+	std::vector<SigRaceData*> pool; // free records
+	std::deque<SigRaceData*> retired; // pushed out, may still be read
+} __attribute__((aligned(64)));
+
+// reclamation epoch of a checker's running scan, 0 if none
+class CheckerEpoch
+{
+public:
+	volatile UINT64 epoch;
+} __attribute__((aligned(64)));
+
+// a race found by a checker, printed at the end in order
+class RaceReport
+{
+public:
+	UINT64 order; // of the signature whose check found it
+	UINT32 otherSlot;
+	std::string text;
+	std::string epochs; // line of race_info.txt
+
+	bool operator<(const RaceReport& rhs) const
+	{
+		return order < rhs.order ||
+		       (order == rhs.order && otherSlot < rhs.otherSlot);
+	}
+};
+
 /*
  * IMPLEMENTATION OF RACE DETECTION MODULE
+ *
+ * Signatures are pushed and scanned without a lock. The records are reused
+ * in place: a pushed out record may still be read by a scan that loaded it,
+ * so it's only reused once every scan running when it was pushed out is over.
+ * A scan notes the global epoch when it starts, a pushed out record the epoch
+ * it left in (bumping it), and the record is free when all the running scans
+ * started later. A scan that finds a newer record than the sequence it
+ * expected has been lapped by the owner and stops there, the rest is newer.
+ *
+ * Without checkers the thread pushing a signature checks it right away. With
+ * them, the signatures go through the insertion gate (insertLock) into the
+ * rings and the check queue in one order, and a check only looks at the
+ * signatures before its own in that order. The gate holds a thread back
+ * (counting a stall, running queued checks meanwhile) until the checks that
+ * may still need the record it overwrites, or the queue entry it takes, are
+ * done. The races found then only depend on the order, not on when the
+ * checkers got to them, and they are printed sorted at the end.
+ *
+ * With a history budget records are evicted once all the rings hold more
+ * than it, the cheapest first (see evictBefore), from the pushing thread's
+ * ring while it holds more than its share and from the largest ring
+ * otherwise, so idle threads' rings are trimmed too. The newest one of a
+ * ring stays. An evicted record is retired like a pushed out one
+ * and scans skip its entry, so the checks still queued may miss it: the
+ * races found with checkers stay the same from run to run only while the
+ * budget isn't hit.
  */
-typedef std::list<SigRaceData*> BlockHistoryQueue;
 class RaceDetectionModule
 {
 public:
 	RaceDetectionModule() :
-			threadCount(0)
-	{}
+			threadCount(0), reclaimEpoch(1), recordCount(0), checkerCount(0),
+			pushCount(0), jobHead(0), checkedPrefix(0), queueStalls(0),
+			ringStalls(0), historyDepth(DEFAULT_HISTORY_DEPTH),
+			ringSize(DEFAULT_HISTORY_DEPTH + 1), historyBudget(0), storedBytes(0),
+			peakStoredBytes(0), fellOff(0), fellOffConcurrent(0), evicted(0),
+			evictedConcurrent(0)
+	{
+		memset((void*) checkerEpochs, 0, sizeof(checkerEpochs));
+		memset((void*) jobDone, 0, sizeof(jobDone));
+	}
 	~RaceDetectionModule()
 	{
-		while (!blockHistoryQueues.empty())
+		for (int i = 0; i < threadCount; i++)
 		{
-			BlockHistoryQueue* queue = blockHistoryQueues.back();
-			blockHistoryQueues.pop_back();
-			while (!queue->empty())
+			SignatureRing* ring = rings[i];
+			for (UINT32 n = 0; n < ring->size; n++)
 			{
-				delete queue->front();
-				queue->pop_front();
+				delete ring->records[n];
 			}
-			delete queue;
+			for (size_t n = 0; n < ring->pool.size(); n++)
+			{
+				delete ring->pool[n];
+			}
+			for (size_t n = 0; n < ring->retired.size(); n++)
+			{
+				delete ring->retired[n];
+			}
+			ring->~SignatureRing();
+			free(ring);
 		}
 	}
 
-	void addSignature(SigRaceData* sigRaceData)
+	UINT32 ringSizeFor(UINT32 depth) const
+	{
+		return checkerCount ? 2 * depth : depth + 1;
+	}
+
+	// before any thread starts, 0 checks synchronously
+	void configureCheckers(int count)
+	{
+		assert(count >= 0 && count <= MAX_CHECKER_COUNT);
+		checkerCount = count;
+		ringSize = ringSizeFor(historyDepth);
+		InitLock(&insertLock);
+		InitLock(&reportLock);
+	}
+
+	/*
+	 * Before any thread starts: the signatures a new one is checked against
+	 * per slot, and the bytes all the rings may keep (0 for no limit). With
+	 * checkers the rings keep twice the depth, for the checks still queued.
+	 * Without them one more, for the entry a push is overwriting (see
+	 * scanRing).
+	 */
+	void configureHistory(UINT32 depth, UINT64 budget)
+	{
+		assert(depth > 0);
+		historyDepth = depth;
+		ringSize = ringSizeFor(historyDepth);
+		historyBudget = budget;
+	}
+
+	/*
+	 * Called by the thread holding the clock slot of ts at the end of its
+	 * epoch, checks the signatures against the other slots' histories or
+	 * queues the check
+	 */
+	void addSignature(int tid, const VectorClock& ts, Bloom& r, Bloom& w)
 	{
-		if (!sigRaceData->isDirty())
+		if (r.isEmpty() && w.isEmpty())
 		{
 			return;
 		}
 
+		// a reused slot continues the ring of the threads that had it
+		// before, which all happen before this one
+		SignatureRing* ring = rings[ts.threadId];
+		SigRaceData* sigRaceData = takeRecord(ring);
+		sigRaceData->assign(tid, ts, r, w);
+
 #ifdef PRINT_SIGNATURES
 		cout << "---SIGNATURE" << endl << sigRaceData->ts <<
 		"read: " << sigRaceData->r <<
 		"write: " << sigRaceData->w << endl;
 #endif
 
-		// add it to the queue
-		BlockHistoryQueue* queue = blockHistoryQueues[sigRaceData->tid];
-		queue->push_front(sigRaceData);
+		if (!checkerCount)
+		{
+			sigRaceData->order = __sync_fetch_and_add(&pushCount, 1);
+			pushRecord(ring, sigRaceData);
+			checkSignature(sigRaceData, &ring->scanEpoch);
+			return;
+		}
+
+		GetLock(&insertLock, tid + 1);
+		UINT64 order = pushCount;
+		sigRaceData->order = order;
+		waitForRingEntry(ring);
+		waitForQueueEntry(ring, order);
+
+		pushRecord(ring, sigRaceData);
+		jobs[order % CHECK_QUEUE_SIZE] = sigRaceData;
+		__sync_synchronize();
+		pushCount = order + 1;
+		ReleaseLock(&insertLock);
+	}
+
+	/*
+	 * Run one queued check, noting the scan in scanEpoch (the caller's),
+	 * false if there was none
+	 */
+	bool checkNext(volatile UINT64* scanEpoch)
+	{
+		UINT64 head = jobHead;
+		if (!checkerCount || head >= pushCount)
+		{
+			return false;
+		}
+		if (!__sync_bool_compare_and_swap(&jobHead, head, head + 1))
+		{
+			// another checker took it
+			return true;
+		}
+
+		checkSignature(jobs[head % CHECK_QUEUE_SIZE], scanEpoch);
+		__sync_synchronize();
+		jobDone[head % CHECK_QUEUE_SIZE] = head + 1;
+		return true;
+	}
+
+	volatile UINT64* checkerEpoch(int checker)
+	{
+		return &checkerEpochs[checker].epoch;
+	}
+
+	// at the end, the Fini thread has the last checker epoch
+	void finishChecks(FILE* out, FILE* epochsOut)
+	{
+		while (checkNext(checkerEpoch(MAX_CHECKER_COUNT)))
+			;
 
-		if (queue->size() > BLOCK_HISTORY_QUEUE_SIZE)
+		std::sort(reports.begin(), reports.end());
+		for (size_t i = 0; i < reports.size(); i++)
+		{
+			fputs(reports[i].text.c_str(), out);
+			fputs(reports[i].epochs.c_str(), epochsOut);
+		}
+		fflush(out);
+		fflush(epochsOut);
+	}
+
+	// one ring per clock slot, called when a new slot is created
+	void addProcessor()
+	{
+		assert(threadCount < MAX_CLOCK_SLOTS);
+		void* memory = NULL;
+		if (posix_memalign(&memory, 64, sizeof(SignatureRing)))
 		{
-			delete queue->back();
-			queue->pop_back();
+			fprintf(stderr, "Couldn't allocate a signature history\n");
+			exit(1);
 		}
+		rings[threadCount] = new (memory) SignatureRing(ringSize);
+
+		// scans only look at the rings before threadCount
+		__sync_synchronize();
+		threadCount++;
+	}
+
+	// signature records allocated, the rest of the pushes reused one
+	UINT64 getRecordCount() const
+	{
+		return recordCount;
+	}
+
+	void printStats(FILE* out)
+	{
+		fprintf(out, "# checkers checked-signatures queue-stalls ring-stalls\n");
+		fprintf(out, "%d %llu %llu %llu\n", checkerCount,
+		        (unsigned long long) pushCount,
+		        (unsigned long long) queueStalls,
+		        (unsigned long long) ringStalls);
+		fprintf(out, "# history-depth history-budget stored-bytes "
+		        "peak-stored-bytes fell-off fell-off-sampled "
+		        "fell-off-sampled-concurrent evicted evicted-sampled "
+		        "evicted-sampled-concurrent\n");
+		fprintf(out, "%u %llu %llu %llu %llu %llu %llu %llu %llu %llu\n",
+		        historyDepth, (unsigned long long) historyBudget,
+		        (unsigned long long) storedBytes,
+		        (unsigned long long) peakStoredBytes,
+		        (unsigned long long) fellOff,
+		        (unsigned long long) sampled(fellOff),
+		        (unsigned long long) fellOffConcurrent,
+		        (unsigned long long) evicted,
+		        (unsigned long long) sampled(evicted),
+		        (unsigned long long) evictedConcurrent);
+	}
+
+private:
+	void checkSignature(SigRaceData* sigRaceData, volatile UINT64* scanEpoch)
+	{
+		*scanEpoch = reclaimEpoch;
+		__sync_synchronize();
 
 		// check it with other threads' values
-		for (UINT32 queueId = 0; queueId < blockHistoryQueues.size(); queueId++)
+		int ringCount = threadCount;
+		for (int ringId = 0; ringId < ringCount; ringId++)
+		{
+			if ((UINT32) ringId != sigRaceData->slot)
+			{
+				scanRing(sigRaceData, rings[ringId], ringId);
+			}
+		}
+
+		__sync_synchronize();
+		*scanEpoch = 0;
+	}
+
+	/*
+	 * A signature of the ring happens before this one iff its own component
+	 * is below what this one knows of the slot and its knowledge of this
+	 * slot is below this one's own. The first part only grows along the
+	 * ring, so the index finds where it stops holding: the signatures from
+	 * there on are concurrent (none of the ones before this one in the order
+	 * can know of a release this thread does after it) and need no clock
+	 * comparison. Below that the clocks decide, usually the first one
+	 * already happens before.
+	 *
+	 * Without checkers the order is taken before the push, so a signature
+	 * later in the order may have scanned before this one was pushed. Those
+	 * are looked at too, with the clocks deciding. The owner of the ring may
+	 * also be pushing meanwhile, overwriting the index entries of the oldest
+	 * sequence before it bumps the count: that one is left out, and the
+	 * searches are redone if the ring moved past what they read.
+	 */
+	void scanRing(SigRaceData* sigRaceData, SignatureRing* ring, UINT32 slot)
+	{
+		// with checkers, the ones pushed later check against this one
+		UINT32 kept = checkerCount ? ring->size : ring->size - 1;
+		UINT64 count, oldest, first, end, concurrent;
+		do
+		{
+			count = ring->count;
+			__sync_synchronize();
+
+			oldest = count > kept ? count - kept : 0;
+			end = ring->firstAfter(oldest, count, sigRaceData->order);
+			first = end - oldest > historyDepth ? end - historyDepth : oldest;
+			concurrent = ring->firstFrom(first, end, sigRaceData->ts.get(slot));
+
+			__sync_synchronize();
+		}
+		while (!checkerCount && ring->count > oldest + kept);
+		UINT64 last = checkerCount ? end : count;
+
+		// newest first
+		for (UINT64 n = last; n > first; n--)
 		{
-			if (queueId == sigRaceData->tid)
+			SigRaceData* other = ring->records[(n - 1) % ring->size];
+			if (!other)
 			{
+				// evicted
 				continue;
 			}
-			queue = blockHistoryQueues[queueId];
-			BlockHistoryQueue::iterator itr;
-			SigRaceData* other;
-			for (itr = queue->begin(); itr != queue->end(); itr++)
+			if (other->sequence != n - 1)
 			{
-				other = *itr;
+				break;
+			}
 
-				// rest is already HB this one
+			if (n > end)
+			{
+				// later in the order, may know of this one
 				if (! sigRaceData->isConcurrent(*other))
 				{
-					break;
+					continue;
 				}
+			}
+			// rest is already HB this one
+			else if (n <= concurrent && ! sigRaceData->isConcurrent(*other))
+			{
+				break;
+			}
 
-				if (sigRaceData->r.hasInCommon(other->w))
-				{
-					fprintf(stderr,
-					        "THERE MAY BE A DATA RACE r-w BETWEEN THREAD-%d & THREAD-%d !!!\n",
-					        sigRaceData->tid, other->tid);
-#ifdef PRINT_DETAILED_RACE_INFO
+			unsigned conflicts = sigRaceData->conflictsWith(*other);
+			if (conflicts)
+			{
+				reportRace(sigRaceData, other, conflicts);
 
-					fprintf(stderr, "Thread %d VC:\n", sigRaceData->tid);
-					sigRaceData->ts.printVector(stderr);
-					fprintf(stderr, "Thread %d VC:\n", other->tid);
-					other->ts.printVector(stderr);
-#endif
+				// one report per thread is enough, go on with the next one
+				break;
+			}
+		}
+	}
 
-					fflush(stderr);
+	void pushRecord(SignatureRing* ring, SigRaceData* sigRaceData)
+	{
+		UINT64 n = ring->count;
+		UINT32 index = n % ring->size;
+		SigRaceData* volatile* entry = &ring->records[index];
+		sigRaceData->sequence = n;
 
-					goto OUTER_FOR;
-				}
-				else if (sigRaceData->w.hasInCommon(other->r))
-				{
-					fprintf(stderr,
-					        "THERE MAY BE A DATA RACE w-r BETWEEN THREAD-%d & THREAD-%d !!!\n",
-					        sigRaceData->tid, other->tid);
-#ifdef PRINT_DETAILED_RACE_INFO
+		// reads the other rings' newest records, protected like a scan
+		ring->scanEpoch = reclaimEpoch;
+		__sync_synchronize();
 
-					fprintf(stderr, "Thread %d VC:\n", sigRaceData->tid);
-					sigRaceData->ts.printVector(stderr);
-					fprintf(stderr, "Thread %d VC:\n", other->tid);
-					other->ts.printVector(stderr);
-#endif
+		// leaves the checked part of the ring with this push
+		SigRaceData* leaving = n >= historyDepth ?
+		                       ring->records[(n - historyDepth) % ring->size] : NULL;
+		if (leaving &&
+		        __sync_fetch_and_add(&fellOff, 1) % CONCURRENCY_SAMPLE == 0 &&
+		        isStillConcurrent(leaving))
+		{
+			__sync_fetch_and_add(&fellOffConcurrent, 1);
+		}
 
-					fflush(stderr);
-					goto OUTER_FOR;
-				}
-				else if (sigRaceData->w.hasInCommon(other->w))
-				{
-					fprintf(stderr,
-					        "THERE MAY BE A DATA RACE w-w BETWEEN THREAD-%d & THREAD-%d !!!\n",
-					        sigRaceData->tid, other->tid);
-#ifdef PRINT_DETAILED_RACE_INFO
+		// the record is complete before it can be seen, the one it replaces
+		// may be evicted by another thread meanwhile
+		ring->orders[index] = sigRaceData->order;
+		ring->clocks[index] = sigRaceData->ts.get(sigRaceData->slot);
+		__sync_synchronize();
+		SigRaceData* old = __sync_lock_test_and_set(entry, sigRaceData);
+		ring->count = n + 1;
+		__sync_synchronize();
 
-					fprintf(stderr, "Thread %d VC:\n", sigRaceData->tid);
-					sigRaceData->ts.printVector(stderr);
-					fprintf(stderr, "Thread %d VC:\n", other->tid);
-					other->ts.printVector(stderr);
-#endif
+		if (old)
+		{
+			retire(ring, old);
+		}
+
+		__sync_fetch_and_add(&ring->bytes, (UINT64) sigRaceData->bytes);
+		UINT64 stored = __sync_add_and_fetch(&storedBytes,
+		                                     (UINT64) sigRaceData->bytes);
+		UINT64 peak = peakStoredBytes;
+		while (stored > peak &&
+		        !__sync_bool_compare_and_swap(&peakStoredBytes, peak, stored))
+		{
+			peak = peakStoredBytes;
+		}
+		if (historyBudget && stored > historyBudget)
+		{
+			evictOverBudget(ring);
+		}
+
+		__sync_synchronize();
+		ring->scanEpoch = 0;
+	}
+
+	/*
+	 * Evict records until all the rings are within the budget again, or
+	 * neither the ring to trim nor the pushing thread's own has more than
+	 * its newest. Called by the owner of own in its push, which protects the
+	 * records of the other rings it loads like a scan.
+	 */
+	void evictOverBudget(SignatureRing* own)
+	{
+		if (checkerCount)
+		{
+			checkedUpTo(pushCount);
+		}
 
-					fflush(stderr);
-					goto OUTER_FOR;
+		while (storedBytes > historyBudget)
+		{
+			SignatureRing* ring = own;
+			int ringCount = threadCount;
+			if (own->bytes * ringCount < storedBytes)
+			{
+				for (int i = 0; i < ringCount; i++)
+				{
+					if (rings[i]->bytes > ring->bytes)
+					{
+						ring = rings[i];
+					}
 				}
 			}
+
+			if (!evictFrom(ring, own) && (ring == own || !evictFrom(own, own)))
+			{
+				return;
+			}
 		}
-OUTER_FOR:
-		return;
 	}
 
-	void addProcessor()
+	/*
+	 * Evict the cheapest record of the ring (never the newest) into own's
+	 * retired list, false if there is none. The ones that already left the
+	 * checked part go first, they're only kept for the checks still queued.
+	 * With checkers (under insertLock) a record waiting for its own check
+	 * stays. The owner may push out the victim meanwhile, then it retires
+	 * it.
+	 */
+	bool evictFrom(SignatureRing* ring, SignatureRing* own)
 	{
-		threadCount++;
-		assert(threadCount < MAX_THREAD_COUNT);
-		blockHistoryQueues.push_back(new BlockHistoryQueue);
+		UINT64 n = ring->count;
+		__sync_synchronize();
+		UINT64 first = n > ring->size ? n - ring->size : 0;
+		UINT64 checked = n > historyDepth ? n - historyDepth : 0;
+
+		SigRaceData* victim = NULL;
+		for (UINT64 i = first; i + 1 < n; i++)
+		{
+			SigRaceData* record = ring->records[i % ring->size];
+			if (!record || record->sequence != i ||
+			        (checkerCount && record->order >= checkedPrefix))
+			{
+				continue;
+			}
+			bool stale = i < checked;
+			bool victimStale = victim && victim->sequence < checked;
+			if (!victim || (stale != victimStale ? stale :
+			                record->evictBefore(*victim)))
+			{
+				victim = record;
+			}
+		}
+		if (!victim)
+		{
+			return false;
+		}
+
+		if (__sync_bool_compare_and_swap(
+		            &ring->records[victim->sequence % ring->size], victim,
+		            (SigRaceData*) NULL))
+		{
+			if (__sync_fetch_and_add(&evicted, 1) % CONCURRENCY_SAMPLE == 0 &&
+			        isStillConcurrent(victim))
+			{
+				__sync_fetch_and_add(&evictedConcurrent, 1);
+			}
+			retire(own, victim);
+		}
+		return true;
+	}
+
+	/*
+	 * Left its ring, goes to the retired list of the given ring and is
+	 * reused once the scans that may have loaded it are over
+	 */
+	void retire(SignatureRing* ring, SigRaceData* record)
+	{
+		__sync_fetch_and_sub(&rings[record->slot]->bytes, (UINT64) record->bytes);
+		__sync_fetch_and_sub(&storedBytes, (UINT64) record->bytes);
+		record->retiredAt = __sync_fetch_and_add(&reclaimEpoch, 1);
+		ring->retired.push_back(record);
+	}
+
+	/*
+	 * Some other slot hadn't synchronized with the record as of its newest
+	 * signature, so a later one of that slot may still race with it. Scans
+	 * all the rings, so only done for a sample of the records leaving them,
+	 * for the statistics, under a scan epoch.
+	 */
+	bool isStillConcurrent(SigRaceData* record)
+	{
+		int ringCount = threadCount;
+		for (int ringId = 0; ringId < ringCount; ringId++)
+		{
+			SignatureRing* ring = rings[ringId];
+			UINT64 count = ring->count;
+			__sync_synchronize();
+			if ((UINT32) ringId == record->slot || !count)
+			{
+				continue;
+			}
+			SigRaceData* newest = ring->records[(count - 1) % ring->size];
+			if (newest && newest->sequence == count - 1 &&
+			        !(*record < *newest))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SigRaceData* takeRecord(SignatureRing* ring)
+	{
+		if (ring->pool.empty() && !ring->retired.empty())
+		{
+			// the oldest scan still running, the records that left the
+			// rings before it started are free
+			UINT64 oldest = reclaimEpoch;
+			int ringCount = threadCount;
+			for (int i = 0; i < ringCount; i++)
+			{
+				oldest = olderEpoch(oldest, rings[i]->scanEpoch);
+			}
+			for (int i = 0; i <= MAX_CHECKER_COUNT; i++)
+			{
+				oldest = olderEpoch(oldest, checkerEpochs[i].epoch);
+			}
+			while (!ring->retired.empty() &&
+			        ring->retired.front()->retiredAt < oldest)
+			{
+				ring->pool.push_back(ring->retired.front());
+				ring->retired.pop_front();
+			}
+		}
+
+		if (ring->pool.empty())
+		{
+			__sync_fetch_and_add(&recordCount, 1);
+			return new SigRaceData();
+		}
+		SigRaceData* record = ring->pool.back();
+		ring->pool.pop_back();
+		return record;
+	}
+
+	// of count records leaving the rings, the ones checked for concurrency
+	static UINT64 sampled(UINT64 count)
+	{
+		return (count + CONCURRENCY_SAMPLE - 1) / CONCURRENCY_SAMPLE;
+	}
+
+	static UINT64 olderEpoch(UINT64 oldest, UINT64 epoch)
+	{
+		return epoch && epoch < oldest ? epoch : oldest;
+	}
+
+	// under insertLock, the checks before it are done
+	bool checkedUpTo(UINT64 order)
+	{
+		while (checkedPrefix < pushCount &&
+		        jobDone[checkedPrefix % CHECK_QUEUE_SIZE] == checkedPrefix + 1)
+		{
+			checkedPrefix++;
+		}
+		return checkedPrefix >= order;
+	}
+
+	/*
+	 * The record that left the checked part of the ring with the last
+	 * historyDepth pushes is overwritten next. Only the checks before that
+	 * one may still look at it.
+	 */
+	void waitForRingEntry(SignatureRing* ring)
+	{
+		UINT64 n = ring->count;
+		if (n < ring->size)
+		{
+			return;
+		}
+		UINT64 order = ring->orders[(n - historyDepth) % ring->size];
+		if (!checkedUpTo(order))
+		{
+			ringStalls++;
+			while (!checkedUpTo(order))
+			{
+				helpChecking(ring);
+			}
+		}
+	}
+
+	// the check that had this entry of the queue is done
+	void waitForQueueEntry(SignatureRing* ring, UINT64 order)
+	{
+		if (order < CHECK_QUEUE_SIZE)
+		{
+			return;
+		}
+		if (!checkedUpTo(order - CHECK_QUEUE_SIZE + 1))
+		{
+			queueStalls++;
+			while (!checkedUpTo(order - CHECK_QUEUE_SIZE + 1))
+			{
+				helpChecking(ring);
+			}
+		}
+	}
+
+	/*
+	 * A stalled thread runs queued checks itself rather than only waiting,
+	 * so the queue drains even when the checkers are gone at exit
+	 */
+	void helpChecking(SignatureRing* ring)
+	{
+		if (!checkNext(&ring->scanEpoch))
+		{
+			PIN_Yield();
+		}
+	}
+
+	void reportRace(SigRaceData* sigRaceData, SigRaceData* other,
+	                unsigned conflicts)
+	{
+		char epochs[RACE_EPOCHS_SIZE];
+		formatRaceEpochs(epochs, sigRaceData, other);
+
+		if (!checkerCount)
+		{
+			printRace(stderr, sigRaceData, other, conflicts);
+			fflush(stderr);
+			fputs(epochs, raceInfoFile);
+			return;
+		}
+
+		RaceReport report;
+		report.order = sigRaceData->order;
+		report.otherSlot = other->slot;
+		report.epochs = epochs;
+
+		char* text = NULL;
+		size_t length = 0;
+		FILE* out = open_memstream(&text, &length);
+		printRace(out, sigRaceData, other, conflicts);
+		fclose(out);
+		report.text = text;
+		free(text);
+
+		GetLock(&reportLock, PIN_ThreadId() + 1);
+		reports.push_back(report);
+		ReleaseLock(&reportLock);
+	}
+
+	// the epochs of both signatures, see raceInfoFile
+	static void formatRaceEpochs(char* line, SigRaceData* sigRaceData,
+	                             SigRaceData* other)
+	{
+		snprintf(line, RACE_EPOCHS_SIZE, "%u %u %u %u %u %u\n",
+		         sigRaceData->tid, sigRaceData->slot,
+		         sigRaceData->ts.get(sigRaceData->slot), other->tid, other->slot,
+		         other->ts.get(other->slot));
+	}
+
+	void printRace(FILE* out, SigRaceData* sigRaceData, SigRaceData* other,
+	               unsigned conflicts)
+	{
+		fprintf(out,
+		        "THERE MAY BE A DATA RACE %s%s%sBETWEEN THREAD-%d & THREAD-%d !!!\n",
+		        conflicts & BLOOM_CONFLICT_RW ? "r-w " : "",
+		        conflicts & BLOOM_CONFLICT_WR ? "w-r " : "",
+		        conflicts & BLOOM_CONFLICT_WW ? "w-w " : "",
+		        sigRaceData->tid, other->tid);
+#ifdef PRINT_DETAILED_RACE_INFO
+
+		fprintf(out, "Thread %d VC:\n", sigRaceData->tid);
+		sigRaceData->ts.printVector(out);
+		fprintf(out, "Thread %d VC:\n", other->tid);
+		other->ts.printVector(out);
+#ifdef SET_OVERRIDE
+		if (conflicts & BLOOM_CONFLICT_RW)
+		{
+			fprintf(out, "r-w addresses: ");
+			sigRaceData->r.printCommon(out, other->w);
+		}
+		if (conflicts & BLOOM_CONFLICT_WR)
+		{
+			fprintf(out, "w-r addresses: ");
+			sigRaceData->w.printCommon(out, other->r);
+		}
+		if (conflicts & BLOOM_CONFLICT_WW)
+		{
+			fprintf(out, "w-w addresses: ");
+			sigRaceData->w.printCommon(out, other->w);
+		}
+#endif
+#endif
 	}
 
-private:
 	void printRaceInfo(string type, int thread1, int thread2)
 	{
 		ADDRINT insPtr = 0; // get this while instrumenting
@@ -276,8 +992,34 @@ private:
 		fflush(stderr);
 	}
 
-	std::vector<BlockHistoryQueue*> blockHistoryQueues;
-	int threadCount;
+	SignatureRing* rings[MAX_CLOCK_SLOTS];
+	volatile int threadCount;
+	volatile UINT64 reclaimEpoch;
+	UINT64 recordCount;
+	CheckerEpoch checkerEpochs[MAX_CHECKER_COUNT + 1];
+
+	int checkerCount;
+	PIN_LOCK insertLock;
+	volatile UINT64 pushCount; // also the end of the check queue
+	SigRaceData* volatile jobs[CHECK_QUEUE_SIZE];
+	volatile UINT64 jobHead; // next check to take
+	volatile UINT64 jobDone[CHECK_QUEUE_SIZE]; // order + 1 once checked
+	UINT64 checkedPrefix; // all the checks before it are done
+	UINT64 queueStalls;
+	UINT64 ringStalls;
+
+	PIN_LOCK reportLock;
+	std::vector<RaceReport> reports;
+
+	UINT32 historyDepth;
+	UINT32 ringSize; // of the rings, see configureHistory
+	UINT64 historyBudget; // bytes, 0 for no limit
+	volatile UINT64 storedBytes; // of the records in the rings
+	volatile UINT64 peakStoredBytes;
+	UINT64 fellOff; // left the checked part of a ring
+	UINT64 fellOffConcurrent; // of the sampled ones, see CONCURRENCY_SAMPLE
+	UINT64 evicted;
+	UINT64 evictedConcurrent; // of the sampled ones
 };
 
 /*
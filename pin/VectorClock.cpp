@@ -1,35 +1,80 @@
 #include "VectorClock.h"
-#include "GlobalVariables.h"
+#include "VectorClockKernels.h"
 
 #include <iomanip>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
+#include <string>
 
-int VectorClock::totalProcessCount = MAX_THREAD_COUNT;
+int VectorClock::totalProcessCount = 0;
 int VectorClock::totalDeletedLockCount = 0;
 
+void VectorClock::init()
+{
+	vc = inlineVc;
+	size = 0;
+	capacity = VECTOR_CLOCK_CAPACITY;
+}
+
+/*
+ * Make room for count components, the new ones are zero
+ */
+void VectorClock::ensure(UINT32 count)
+{
+	if (count <= size)
+	{
+		return;
+	}
+
+	if (count > capacity)
+	{
+		UINT32 newCapacity = std::max(count, capacity * 2);
+		UINT32* values = (UINT32*) malloc(newCapacity * sizeof(UINT32));
+		memcpy(values, vc, size * sizeof(UINT32));
+		if (vc != inlineVc)
+		{
+			free(vc);
+		}
+		vc = values;
+		capacity = newCapacity;
+	}
+
+	memset(vc + size, 0, (count - size) * sizeof(UINT32));
+	size = count;
+}
+
+// copy the components, growing onto the heap if they don't fit
+void VectorClock::copyFrom(const VectorClock& other)
+{
+	threadId = other.threadId;
+	if (other.size > capacity)
+	{
+		size = 0;
+		ensure(other.size);
+	}
+	memcpy(vc, other.vc, other.size * sizeof(UINT32));
+	size = other.size;
+}
+
 // used for backwards compatibility purposes only
 VectorClock::VectorClock()
 {
+	init();
 	threadId = NON_THREAD_VECTOR_CLOCK;
-
-	size_t byteCount = sizeof(int) * totalProcessCount;
-	vc = (UINT32*) malloc(byteCount);
-	memset(vc, 0, byteCount);
 }
 
 VectorClock::VectorClock(int processId)
 {
+	init();
 	threadId = processId;
-	assert(threadId < totalProcessCount);
-
-	size_t byteCount = sizeof(int) * totalProcessCount;
-	vc = (UINT32*) malloc(byteCount);
-	memset(vc, 0, byteCount);
 
 	if (threadId != NON_THREAD_VECTOR_CLOCK)
-		vc[processId] = 1;
+	{
+		set(processId, 1);
+	}
 }
 
 /*
@@ -37,30 +82,28 @@ VectorClock::VectorClock(int processId)
  */
 VectorClock::VectorClock(VectorClock& vectorClock, int processId)
 {
+	init();
 	*this = vectorClock;
 	this->threadId = processId;
 
 	// increment values to create a happens before relationship
-	vc[threadId]++;
-	vc[vectorClock.threadId]++;
+	set(threadId, get(threadId) + 1);
+	set(vectorClock.threadId, get(vectorClock.threadId) + 1);
 }
 
 VectorClock::VectorClock(const VectorClock& copyVC)
 {
-	threadId = copyVC.threadId;
-	size_t byteCount = sizeof(int) * totalProcessCount;
-	vc = (UINT32*) malloc(byteCount);
-	memcpy(vc, copyVC.vc, byteCount);
+	init();
+	copyFrom(copyVC);
 }
 
+/*
+ * Read the comma separated components, as many as the writer's clock had
+ */
 VectorClock::VectorClock(istream& in, int processId)
 {
+	init();
 	threadId = processId;
-	assert(threadId < totalProcessCount);
-
-	size_t byteCount = sizeof(int) * totalProcessCount;
-	vc = (UINT32*) malloc(byteCount);
-	memset(vc, 0, byteCount);
 
 	int i = 0;
 	string s;
@@ -72,27 +115,64 @@ VectorClock::VectorClock(istream& in, int processId)
 			break;
 		}
 
-		assert(i < totalProcessCount);
-		vc[i++] = atoi(s.c_str());
+		UINT32 value = atoi(s.c_str());
+		if (value)
+		{
+			set(i, value);
+		}
+		i++;
 	}
-
-	assert(i == totalProcessCount);
 }
 
 const VectorClock& VectorClock::operator=(const VectorClock& vcRight)
 {
-	threadId = vcRight.threadId;
-	size_t byteCount = sizeof(int) * totalProcessCount;
-	vc = (UINT32*) malloc(byteCount);
-	memcpy(vc, vcRight.vc, byteCount);
+	if (this != &vcRight)
+	{
+		copyFrom(vcRight);
+	}
 
 	return *this;
 }
 
+/*
+ * There are no move semantics in C++98, std::swap is specialized to this.
+ * Heap components change hands, only inline ones are copied.
+ */
+void VectorClock::swap(VectorClock& other)
+{
+	bool onHeap = vc != inlineVc;
+	bool otherOnHeap = other.vc != other.inlineVc;
+	if (onHeap && otherOnHeap)
+	{
+		std::swap(vc, other.vc);
+	}
+	else if (!onHeap && !otherOnHeap)
+	{
+		std::swap_ranges(inlineVc, inlineVc + std::max(size, other.size),
+		                 other.inlineVc);
+	}
+	else
+	{
+		VectorClock& inlined = onHeap ? other : *this;
+		VectorClock& allocated = onHeap ? *this : other;
+		memcpy(allocated.inlineVc, inlined.inlineVc,
+		       inlined.size * sizeof(UINT32));
+		inlined.vc = allocated.vc;
+		allocated.vc = allocated.inlineVc;
+	}
+
+	std::swap(size, other.size);
+	std::swap(capacity, other.capacity);
+	std::swap(threadId, other.threadId);
+}
+
 VectorClock::~VectorClock()
 {
 	totalDeletedLockCount++;
-	free(vc);
+	if (vc != inlineVc)
+	{
+		free(vc);
+	}
 }
 
 void VectorClock::sendEvent()
@@ -102,51 +182,51 @@ void VectorClock::sendEvent()
 
 void VectorClock::set(int index, UINT32 value)
 {
-	assert(index < totalProcessCount);
+	ensure(index + 1);
 	vc[index] = value;
 }
 
 UINT32 VectorClock::get()
 {
 	assert(threadId != NON_THREAD_VECTOR_CLOCK);
-	return vc[threadId];
+	return get(threadId);
+}
+
+UINT32 VectorClock::get(int index) const
+{
+	return (UINT32) index < size ? vc[index] : 0;
 }
 
 void VectorClock::clear()
 {
-	memset(vc, 0, totalProcessCount * sizeof(UINT32));
+	size = 0;
 }
 
 void VectorClock::advance()
 {
+	ensure(threadId + 1);
 	vc[threadId]++;
 }
 
 void VectorClock::receiveAction(VectorClock& vectorClockReceived)
 {
-	UINT32 *receivedClockValues = vectorClockReceived.vc;
-	for (int i = 0; i < totalProcessCount; ++i)
-		vc[i] = (vc[i] > receivedClockValues[i]) ?
-		        vc[i] : receivedClockValues[i];
-
+	ensure(vectorClockReceived.size);
+	vectorClockKernels.join(vc, vectorClockReceived.vc, vectorClockReceived.size);
 }
 
 void VectorClock::receiveWithIncrement(VectorClock& vectorClockReceived)
 {
-	UINT32 *receivedClockValues = vectorClockReceived.vc;
-	for (int i = 0; i < totalProcessCount; ++i)
-		vc[i] = (vc[i] > receivedClockValues[i]) ?
-		        vc[i] : receivedClockValues[i];
+	receiveAction(vectorClockReceived);
 
-	vc[threadId]++;
-	vc[vectorClockReceived.threadId]++;
+	int otherId = vectorClockReceived.threadId;
+	set(threadId, get(threadId) + 1);
+	set(otherId, get(otherId) + 1);
 }
 
 void VectorClock::receiveActionFromSpecialPoint(
     VectorClock& vectorClockReceived, UINT32 specialPoint)
 {
-	UINT32 *receivedClockValues = vectorClockReceived.vc;
-	vc[specialPoint] = receivedClockValues[specialPoint];
+	set(specialPoint, vectorClockReceived.get(specialPoint));
 }
 
 bool VectorClock::happensBefore(const VectorClock& input) const
@@ -157,7 +237,7 @@ bool VectorClock::happensBefore(const VectorClock& input) const
 bool VectorClock::isUniqueValue(int processIdIn) const
 {
 	bool isUnique = true;
-	for (int i = 0; i < totalProcessCount; ++i)
+	for (int i = 0; i < (int) size; ++i)
 	{
 		if (vc[i] > 0 && i != processIdIn)
 		{
@@ -171,26 +251,37 @@ bool VectorClock::isUniqueValue(int processIdIn) const
 
 bool VectorClock::isEmpty()
 {
-	for (int i = 0; i < totalProcessCount; ++i)
+	return vectorClockKernels.isZero(vc, size);
+}
+
+/*
+ * Components [from, to) of this clock are <= the ones of rhs
+ */
+bool VectorClock::lessEqualIn(const VectorClock& rhs, UINT32 from,
+                              UINT32 to) const
+{
+	to = std::min(to, size);
+	if (from >= to)
 	{
-		if (vc[i] != 0)
-			return false;
+		return true;
 	}
 
-	return true;
+	// the ones rhs doesn't have are zero there
+	UINT32 common = std::max(from, std::min(rhs.size, to));
+	return vectorClockKernels.lessEqual(vc + from, rhs.vc + from, common - from)
+	       && vectorClockKernels.isZero(vc + common, to - common);
 }
 
 bool VectorClock::happensBeforeSpecial(const VectorClock* input,
                                        UINT32 processId) const
 {
-	UINT32* vRightValues = input->vc;
-	for (int i = 0; i < totalProcessCount; ++i)
+	for (UINT32 i = 0; i < size; ++i)
 	{
-		if ((uint32_t) i == processId)
+		if (i == processId)
 			continue;
 
 		//at least ONE value is stricly smaller
-		if (vc[i] > 0 && vc[i] >= vRightValues[i])
+		if (vc[i] > 0 && vc[i] >= input->get(i))
 			return true;
 	}
 
@@ -206,18 +297,23 @@ bool VectorClock::isConcurrent(const VectorClock& input) const
 bool VectorClock::lessThanGRT(const VectorClock& GRT)
 {
 	assert(GRT.threadId == NON_THREAD_VECTOR_CLOCK);
+	assert(threadId != NON_THREAD_VECTOR_CLOCK);
+
+	// all but the thread's own component
+	return lessEqualIn(GRT, 0, threadId) &&
+	       lessEqualIn(GRT, threadId + 1, size);
+}
 
-	for (int i = 0; i < totalProcessCount; ++i)
-		if (i != threadId && vc[i] > GRT.vc[i])
-			return false;
-	return true;
+bool VectorClock::lessEqual(const VectorClock& rhs) const
+{
+	return lessEqualIn(rhs, 0, size);
 }
 
 void VectorClock::updateGRT(const VectorClock& TRT)
 {
 	assert(threadId == NON_THREAD_VECTOR_CLOCK);
 
-	vc[TRT.threadId] = TRT.vc[TRT.threadId];
+	set(TRT.threadId, TRT.get(TRT.threadId));
 }
 
 void VectorClock::toString()
@@ -231,26 +327,25 @@ void VectorClock::toString()
 ostream& operator<<(ostream& os, const VectorClock& v)
 {
 	os << "Vector Clock Of " << v.threadId << ":" << endl;
-	UINT32 *values = v.vc;
-	for (int i = 0; i < v.totalProcessCount - 1; ++i)
+	for (int i = 0; i < (int) v.size - 1; ++i)
 	{
-		os << values[i] << ",";
+		os << v.vc[i] << ",";
 	}
-	os << values[v.totalProcessCount - 1] << endl;
+	os << v.get(v.size - 1) << endl;
 
 	return os;
 }
 
 VectorClock& VectorClock::operator++()
 {
-	vc[threadId]++;
+	advance();
 	return *this;
 }
 
 VectorClock VectorClock::operator++(int)
 {
 	VectorClock tmp = *this;
-	vc[threadId]++;
+	advance();
 	return tmp;
 }
 
@@ -263,13 +358,13 @@ bool VectorClock::operator<(const VectorClock& vRight) const
 {
 	if (threadId == vRight.threadId)
 	{
-		return vc[threadId] < vRight.vc[vRight.threadId];
+		return get(threadId) < vRight.get(vRight.threadId);
 	}
 
-	UINT32 l_l = vc[threadId];
-	UINT32 l_r = vc[vRight.threadId];
-	UINT32 r_r = vRight.vc[vRight.threadId];
-	UINT32 r_l = vRight.vc[threadId];
+	UINT32 l_l = get(threadId);
+	UINT32 l_r = get(vRight.threadId);
+	UINT32 r_r = vRight.get(vRight.threadId);
+	UINT32 r_l = vRight.get(threadId);
 
 	// both threads' values are lower in the lhs thread
 	return l_l < r_l && l_r < r_r;
@@ -282,19 +377,20 @@ bool VectorClock::operator!=(const VectorClock& vRight) const
 
 bool VectorClock::operator==(const VectorClock& vRight) const
 {
-	UINT32 *vRightValues = vRight.vc;
-	for (int i = 0; i < totalProcessCount; ++i)
-		if (vc[i] != vRightValues[i])
-			return false;
+	const VectorClockKernels& k = vectorClockKernels;
+	UINT32 common = std::min(size, vRight.size);
 
-	return true;
+	return k.equal(vc, vRight.vc, common) &&
+	       k.isZero(vc + common, size - common) &&
+	       k.isZero(vRight.vc + common, vRight.size - common);
 }
 
+// writes the clock's own components, readers treat the missing ones as zero
 int VectorClock::printVector(FILE* out)
 {
-	for (int i = 0; i < totalProcessCount - 1; ++i)
+	for (int i = 0; i < (int) size - 1; ++i)
 	{
 		fprintf(out, "%d,", vc[i]);
 	}
-	return fprintf(out, "%d\n", vc[totalProcessCount - 1]);
+	return fprintf(out, "%d\n", get(size - 1));
 }
@@ -15,12 +15,31 @@
 
 #define NON_THREAD_VECTOR_CLOCK -1
 
+/*
+ * Clocks of up to this many components are stored inline, so copying one
+ * never allocates. Clocks grow onto the heap when more threads are created.
+ */
+#ifndef VECTOR_CLOCK_CAPACITY
+#define VECTOR_CLOCK_CAPACITY 32
+#endif
+
 class VectorClock
 {
 private:
+	// components [0, size) are valid, the ones after them are zero
 	UINT32* vc;
+	UINT32 size;
+	UINT32 capacity;
+	UINT32 inlineVc[VECTOR_CLOCK_CAPACITY];
+
+	void init();
+	void ensure(UINT32 count);
+	void copyFrom(const VectorClock& other);
+	bool lessEqualIn(const VectorClock& rhs, UINT32 from, UINT32 to) const;
 public:
 	int threadId;
+
+	// number of thread slots handed out, clocks have at most this many
 	static int totalProcessCount;
 	static int totalDeletedLockCount;
 
@@ -41,6 +60,7 @@ public:
 	void sendEvent();
 	void set(int index, UINT32 value);
 	UINT32 get();
+	UINT32 get(int index) const;
 	void clear();
 
 	// happens-before functions
@@ -51,12 +71,16 @@ public:
 
 	// re-execute helper methods
 	bool lessThanGRT(const VectorClock& GRT);
+
+	// every component is <= the one of rhs
+	bool lessEqual(const VectorClock& rhs) const;
 	void updateGRT(const VectorClock& TRT);
 
 	// operators
 	VectorClock& operator++(); //prefix increment ++vclock
 	VectorClock operator++(int x); //postfix increment
 	const VectorClock& operator=(const VectorClock& vcRight);
+	void swap(VectorClock& other);
 	bool operator==(const VectorClock &vRight) const;
 	bool operator!=(const VectorClock &vRight) const;
 	bool operator<(const VectorClock& vRight) const;
@@ -65,8 +89,29 @@ public:
 
 	// utilities
 	bool isEmpty();
+
+	// components it has, the ones after them are zero
+	UINT32 getSize() const
+	{
+		return size;
+	}
+
+	// allocated beyond the object, once the components don't fit inline
+	size_t getHeapBytes() const
+	{
+		return vc != inlineVc ? capacity * sizeof(UINT32) : 0;
+	}
 	int printVector(FILE* out);
 	void toString();
 };
 
+namespace std
+{
+template<>
+inline void swap(VectorClock& a, VectorClock& b)
+{
+	a.swap(b);
+}
+}
+
 #endif /* VECTORCLOCK_H_ */
@@ -0,0 +1,247 @@
+/*
+ * VectorClockKernels.cpp
+ *
+ * The clocks are arrays of any length and alignment, so the vector kernels
+ * use unaligned loads and finish the last few components with the scalar
+ * loops. The comparisons OR the differences together and test once at the
+ * end: clocks are short and a single branch beats an early exit.
+ */
+
+#include <string.h>
+
+#include "VectorClockKernels.h"
+#include "CpuFeatures.h"
+
+#ifdef CPU_HAVE_TARGET_ATTRIBUTE
+#define CLOCK_HAVE_SIMD
+#include <immintrin.h>
+#define SSE41_TARGET __attribute__((target("sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/* === SCALAR ========================================================= */
+
+static void joinScalar(uint32_t* a, const uint32_t* b, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		a[i] = a[i] > b[i] ? a[i] : b[i];
+}
+
+static bool equalScalar(const uint32_t* a, const uint32_t* b, size_t count)
+{
+	uint32_t diff = 0;
+	for (size_t i = 0; i < count; ++i)
+		diff |= a[i] ^ b[i];
+	return diff == 0;
+}
+
+static bool lessEqualScalar(const uint32_t* a, const uint32_t* b,
+                            size_t count)
+{
+	bool greater = false;
+	for (size_t i = 0; i < count; ++i)
+		greater |= a[i] > b[i];
+	return !greater;
+}
+
+static bool isZeroScalar(const uint32_t* a, size_t count)
+{
+	uint32_t any = 0;
+	for (size_t i = 0; i < count; ++i)
+		any |= a[i];
+	return any == 0;
+}
+
+#ifdef CLOCK_HAVE_SIMD
+
+/* === SSE4.1 ========================================================= */
+
+SSE41_TARGET
+static void joinSSE41(uint32_t* a, const uint32_t* b, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+		_mm_storeu_si128((__m128i*) (a + i), _mm_max_epu32(x, y));
+	}
+	joinScalar(a + i, b + i, count - i);
+}
+
+SSE41_TARGET
+static bool equalSSE41(const uint32_t* a, const uint32_t* b, size_t count)
+{
+	__m128i diff = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+		diff = _mm_or_si128(diff, _mm_xor_si128(x, y));
+	}
+	return _mm_testz_si128(diff, diff) && equalScalar(a + i, b + i, count - i);
+}
+
+// a <= b where max(a, b) == b
+SSE41_TARGET
+static bool lessEqualSSE41(const uint32_t* a, const uint32_t* b,
+                           size_t count)
+{
+	__m128i diff = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+		diff = _mm_or_si128(diff, _mm_xor_si128(_mm_max_epu32(x, y), y));
+	}
+	return _mm_testz_si128(diff, diff) &&
+	       lessEqualScalar(a + i, b + i, count - i);
+}
+
+SSE41_TARGET
+static bool isZeroSSE41(const uint32_t* a, size_t count)
+{
+	__m128i any = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		any = _mm_or_si128(any, _mm_loadu_si128((const __m128i*) (a + i)));
+	}
+	return _mm_testz_si128(any, any) && isZeroScalar(a + i, count - i);
+}
+
+/* === AVX2 =========================================================== */
+
+AVX2_TARGET
+static void joinAVX2(uint32_t* a, const uint32_t* b, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+		_mm256_storeu_si256((__m256i*) (a + i), _mm256_max_epu32(x, y));
+	}
+	joinScalar(a + i, b + i, count - i);
+}
+
+AVX2_TARGET
+static bool equalAVX2(const uint32_t* a, const uint32_t* b, size_t count)
+{
+	__m256i diff = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+		diff = _mm256_or_si256(diff, _mm256_xor_si256(x, y));
+	}
+	return _mm256_testz_si256(diff, diff) &&
+	       equalScalar(a + i, b + i, count - i);
+}
+
+AVX2_TARGET
+static bool lessEqualAVX2(const uint32_t* a, const uint32_t* b, size_t count)
+{
+	__m256i diff = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+		diff = _mm256_or_si256(diff,
+		                       _mm256_xor_si256(_mm256_max_epu32(x, y), y));
+	}
+	return _mm256_testz_si256(diff, diff) &&
+	       lessEqualScalar(a + i, b + i, count - i);
+}
+
+AVX2_TARGET
+static bool isZeroAVX2(const uint32_t* a, size_t count)
+{
+	__m256i any = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		any = _mm256_or_si256(any,
+		                      _mm256_loadu_si256((const __m256i*) (a + i)));
+	}
+	return _mm256_testz_si256(any, any) && isZeroScalar(a + i, count - i);
+}
+
+#else
+
+// never selected, isClockKernelSupported says no
+#define joinSSE41      joinScalar
+#define equalSSE41     equalScalar
+#define lessEqualSSE41 lessEqualScalar
+#define isZeroSSE41    isZeroScalar
+#define joinAVX2       joinScalar
+#define equalAVX2      equalScalar
+#define lessEqualAVX2  lessEqualScalar
+#define isZeroAVX2     isZeroScalar
+
+#endif
+
+/* === DISPATCH ======================================================= */
+
+const VectorClockKernels vectorClockKernelTable[CLOCK_KERNEL_COUNT] =
+{
+	{ "scalar", joinScalar, equalScalar, lessEqualScalar, isZeroScalar },
+	{ "sse41", joinSSE41, equalSSE41, lessEqualSSE41, isZeroSSE41 },
+	{ "avx2", joinAVX2, equalAVX2, lessEqualAVX2, isZeroAVX2 }
+};
+
+VectorClockKernels vectorClockKernels =
+    vectorClockKernelTable[CLOCK_KERNEL_SCALAR];
+
+bool isClockKernelSupported(ClockKernelType type)
+{
+	switch (type)
+	{
+	case CLOCK_KERNEL_SCALAR:
+		return true;
+#ifdef CLOCK_HAVE_SIMD
+	case CLOCK_KERNEL_SSE41:
+		return cpuHasSSE41();
+	case CLOCK_KERNEL_AVX2:
+		return cpuHasAVX2();
+#endif
+	default:
+		return false;
+	}
+}
+
+bool selectVectorClockKernels(const char* name)
+{
+	if (strcmp(name, "auto") == 0)
+	{
+		ClockKernelType type = CLOCK_KERNEL_SCALAR;
+		if (isClockKernelSupported(CLOCK_KERNEL_AVX2))
+		{
+			type = CLOCK_KERNEL_AVX2;
+		}
+		else if (isClockKernelSupported(CLOCK_KERNEL_SSE41))
+		{
+			type = CLOCK_KERNEL_SSE41;
+		}
+		vectorClockKernels = vectorClockKernelTable[type];
+		return true;
+	}
+
+	for (int type = 0; type < CLOCK_KERNEL_COUNT; type++)
+	{
+		if (strcmp(name, vectorClockKernelTable[type].name) == 0)
+		{
+			if (!isClockKernelSupported((ClockKernelType) type))
+			{
+				return false;
+			}
+			vectorClockKernels = vectorClockKernelTable[type];
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,53 @@
+/*
+ * VectorClockKernels.h
+ *
+ * Scalar/SSE4.1/AVX2 kernels over the components of vector clocks, chosen at
+ * startup according to the running CPU. Joins and comparisons run while
+ * holding rdmLock or GRTLock, so they set how long those are held. Doesn't
+ * depend on pin.H so that the micro benchmark in fasthashing/ can be built
+ * without Pin.
+ */
+
+#ifndef VECTORCLOCKKERNELS_H_
+#define VECTORCLOCKKERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*ClockJoinFunc)(uint32_t* a, const uint32_t* b, size_t count);
+typedef bool (*ClockCompareFunc)(const uint32_t* a, const uint32_t* b,
+                                 size_t count);
+typedef bool (*ClockIsZeroFunc)(const uint32_t* a, size_t count);
+
+typedef enum
+{
+	CLOCK_KERNEL_SCALAR, CLOCK_KERNEL_SSE41, CLOCK_KERNEL_AVX2,
+	CLOCK_KERNEL_COUNT
+} ClockKernelType;
+
+class VectorClockKernels
+{
+public:
+	const char* name;
+	ClockJoinFunc join;          // a[i] = max(a[i], b[i])
+	ClockCompareFunc equal;      // a[i] == b[i] for all i
+	ClockCompareFunc lessEqual;  // a[i] <= b[i] for all i
+	ClockIsZeroFunc isZero;      // a[i] == 0 for all i
+};
+
+// kernels used by VectorClock, the scalar loops until selected
+extern VectorClockKernels vectorClockKernels;
+
+// all kernels, indexed by ClockKernelType
+extern const VectorClockKernels vectorClockKernelTable[CLOCK_KERNEL_COUNT];
+
+bool isClockKernelSupported(ClockKernelType type);
+
+/*
+ * Select the kernels by name ("scalar", "sse41", "avx2") or the best
+ * supported one for "auto". Returns false if the name is unknown or not
+ * supported by the CPU, keeping the previous selection.
+ */
+bool selectVectorClockKernels(const char* name);
+
+#endif /* VECTORCLOCKKERNELS_H_ */
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+
+# Before/after throughput benchmark of two builds of the tool on the pthread
+# tests in pin-replay/test.
+#
+# Build the two tools first, e.g. the old locked signature inserts against the
+# current lock-free ones:
+#
+#   make TOOL_DEFS=-DLOCKED_SIGNATURE_INSERT OBJDIR=obj-locked/
+#   make
+#   make -C ../pin-replay/test
+#
+#   ./bench_runner.py <pin> obj-locked/MyPinTool.so obj-intel64/MyPinTool.so
+
+import os
+import subprocess
+import sys
+import time
+
+test_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "..", "pin-replay", "test")
+test_count = 10
+repeat = 5
+
+def run_once(pin, tool, app):
+	devnull = open(os.devnull, "w")
+	start = time.time()
+	subprocess.Popen("%s -t %s -- %s" % (pin, tool, app), shell=True,
+	                 stdout=devnull, stderr=devnull).wait()
+	devnull.close()
+	return time.time() - start
+
+def median(values):
+	values = sorted(values)
+	return values[len(values) // 2]
+
+def bench(pin, tool, app):
+	return median([run_once(pin, tool, app) for i in range(repeat)])
+
+if len(sys.argv) != 4:
+	print("usage: %s <pin> <before-tool.so> <after-tool.so>" % sys.argv[0])
+	sys.exit(1)
+
+pin, before, after = sys.argv[1:]
+
+print("%-8s %10s %10s %8s" % ("test", "before(s)", "after(s)", "speedup"))
+for i in range(test_count):
+	app = os.path.join(test_dir, "test%d" % i)
+	if not os.path.exists(app):
+		continue
+	t_before = bench(pin, before, app)
+	t_after = bench(pin, after, app)
+	print("%-8s %10.3f %10.3f %7.2fx" % ("test%d" % i, t_before, t_after,
+	                                     t_before / t_after))
@@ -0,0 +1,176 @@
+/**
+ * Compares the Bloom filter kernels of the pin tool (../BloomKernels.cpp):
+ * the original byte loop against the word, SSE2 and AVX2 versions, and the
+ * three intersections of a signature pair against the fused conflict kernel.
+ *
+ * Compile with "make bloom", run as ./bloomspeedtesting [repeat]
+ */
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ztimer.h"
+#include "ZRandom.h"
+#include "../BloomKernels.h"
+
+using namespace std;
+
+// number of filter pairs, enough to fall out of L1 like the history queues do
+#define PAIR_COUNT 256
+
+class FilterSet
+{
+public:
+	vector<uint64_t*> filters;
+	size_t words;
+
+	FilterSet(size_t bits, size_t count) :
+			words(bits / BLOOM_WORD_BITS)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			void* p = NULL;
+			if (posix_memalign(&p, BLOOM_ALIGN_BYTES, words * sizeof(uint64_t)))
+			{
+				exit(1);
+			}
+			memset(p, 0, words * sizeof(uint64_t));
+			filters.push_back((uint64_t*) p);
+		}
+	}
+
+	~FilterSet()
+	{
+		for (size_t i = 0; i < filters.size(); ++i)
+		{
+			free(filters[i]);
+		}
+	}
+};
+
+/*
+ * Disjoint filters (even bits for a, odd bits for b) are the worst case for
+ * the intersection: no early exit, the whole filter is scanned.
+ */
+static void fillDisjoint(FilterSet& a, FilterSet& b, size_t bitsPerFilter,
+                         ZRandom& zr)
+{
+	size_t bits = a.words * BLOOM_WORD_BITS;
+	for (size_t i = 0; i < a.filters.size(); ++i)
+	{
+		for (size_t k = 0; k < bitsPerFilter; ++k)
+		{
+			size_t bit = (zr.getValue() % (bits / 2)) * 2;
+			a.filters[i][bit / 64] |= 1ULL << (bit % 64);
+			bit++;
+			b.filters[i][bit / 64] |= 1ULL << (bit % 64);
+		}
+	}
+}
+
+static double testIntersect(const BloomKernels& k, FilterSet& a, FilterSet& b,
+                            uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < a.filters.size(); ++i)
+			answer += k.intersect(a.filters[i], b.filters[i], a.words);
+	return t.split() / 1000.0;
+}
+
+// r1 & w2, w1 & r2, w1 & w2 as separate passes, like addSignature used to
+static double testThreePass(const BloomKernels& k, FilterSet& a, FilterSet& b,
+                            uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i + 1 < a.filters.size(); i += 2)
+		{
+			const uint64_t* r1 = a.filters[i], *w1 = a.filters[i + 1];
+			const uint64_t* r2 = b.filters[i], *w2 = b.filters[i + 1];
+			answer += k.intersect(r1, w2, a.words) || k.intersect(w1, r2, a.words)
+			          || k.intersect(w1, w2, a.words);
+		}
+	return t.split() / 1000.0;
+}
+
+static double testFused(const BloomKernels& k, FilterSet& a, FilterSet& b,
+                        uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i + 1 < a.filters.size(); i += 2)
+			answer += k.conflicts(a.filters[i], a.filters[i + 1], b.filters[i],
+			                      b.filters[i + 1], a.words);
+	return t.split() / 1000.0;
+}
+
+static double testIsEmpty(const BloomKernels& k, FilterSet& a, uint32_t repeat,
+                          uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < a.filters.size(); ++i)
+			answer += k.isEmpty(a.filters[i], a.words);
+	return t.split() / 1000.0;
+}
+
+static double testClear(const BloomKernels& k, FilterSet& a, uint32_t repeat,
+                        uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < a.filters.size(); ++i)
+		{
+			k.clear(a.filters[i], a.words);
+			a.filters[i][r % a.words] = 1; // keep the stores alive
+		}
+	answer += a.filters[0][0];
+	return t.split() / 1000.0;
+}
+
+int main(int params, char ** args)
+{
+	uint32_t repeat = params >= 2 ? atoi(args[1]) : 20000;
+	uint64_t answer = 0;
+	ZRandom zr;
+
+	cout << "# " << PAIR_COUNT << " filter pairs, repeating each run " << repeat
+	     << " times, seconds" << endl;
+	cout << "# bits kernel intersect(disjoint) isempty(empty) clear"
+	     " threepass(disjoint) fused(disjoint)" << endl;
+
+	for (size_t bits = 2048; bits <= 65536; bits *= 4)
+	{
+		FilterSet a(bits, PAIR_COUNT), b(bits, PAIR_COUNT), empty(bits,
+		        PAIR_COUNT);
+		fillDisjoint(a, b, bits / 16, zr);
+
+		for (int type = 0; type < BLOOM_KERNEL_COUNT; ++type)
+		{
+			if (!isBloomKernelSupported((BloomKernelType) type))
+			{
+				continue;
+			}
+			const BloomKernels& k = bloomKernelTable[type];
+
+			double intersect = testIntersect(k, a, b, repeat, answer);
+			double isEmpty = testIsEmpty(k, empty, repeat, answer);
+			double clear = testClear(k, empty, repeat, answer);
+			double threePass = testThreePass(k, a, b, repeat, answer);
+			double fused = testFused(k, a, b, repeat, answer);
+			cout << bits << " " << k.name << " " << intersect << " " << isEmpty
+			     << " " << clear << " " << threePass << " " << fused << endl;
+
+			// clear leaves a bit behind
+			for (size_t i = 0; i < empty.filters.size(); ++i)
+				bloomKernelTable[BLOOM_KERNEL_WORD].clear(empty.filters[i],
+				        empty.words);
+		}
+		cout << endl;
+	}
+
+	// an intersection can't be found between disjoint filters
+	return answer != 0 && answer % 2 == 1;
+}
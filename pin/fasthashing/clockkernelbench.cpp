@@ -0,0 +1,159 @@
+/**
+ * Compares the vector clock kernels of the pin tool (../VectorClockKernels.cpp):
+ * the scalar loops against the SSE4.1 and AVX2 versions for clocks of 32, 64
+ * and 256 components, plus 67 for the scalar tail of the vector kernels.
+ *
+ * join: a = max(a, b), like receiveAction.
+ * equal: equal clocks, like operator== (no early exit possible).
+ * lessequal: a <= b, like lessThanGRT on a thread allowed to go.
+ * iszero: an empty clock, like isEmpty.
+ *
+ * Compile with "make clockkernels", run as ./clockkernelbench [repeat]
+ */
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ztimer.h"
+#include "ZRandom.h"
+#include "../VectorClockKernels.h"
+
+using namespace std;
+
+// number of clock pairs, like the clocks of the locks a thread goes through
+#define PAIR_COUNT 256
+
+class ClockSet
+{
+public:
+	vector<uint32_t> values;
+	size_t count;
+
+	ClockSet(size_t count, ZRandom& zr) :
+			values(PAIR_COUNT * count), count(count)
+	{
+		for (size_t i = 0; i < values.size(); ++i)
+			values[i] = zr.getValue() % 1000;
+	}
+
+	uint32_t* clock(size_t i)
+	{
+		return &values[i * count];
+	}
+};
+
+static double testJoin(const VectorClockKernels& k, ClockSet& a, ClockSet& b,
+                       uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < PAIR_COUNT; ++i)
+			k.join(a.clock(i), b.clock(i), a.count);
+	answer += a.clock(0)[0];
+	return t.split() / 1000.0;
+}
+
+static double testEqual(const VectorClockKernels& k, ClockSet& a,
+                        uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < PAIR_COUNT; ++i)
+			answer += k.equal(a.clock(i), a.clock(i), a.count);
+	return t.split() / 1000.0;
+}
+
+static double testLessEqual(const VectorClockKernels& k, ClockSet& a,
+                            ClockSet& b, uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < PAIR_COUNT; ++i)
+			answer += k.lessEqual(b.clock(i), a.clock(i), a.count);
+	return t.split() / 1000.0;
+}
+
+static double testIsZero(const VectorClockKernels& k, ClockSet& zero,
+                         uint32_t repeat, uint64_t& answer)
+{
+	ZTimer t;
+	for (uint32_t r = 0; r < repeat; ++r)
+		for (size_t i = 0; i < PAIR_COUNT; ++i)
+			answer += k.isZero(zero.clock(i), zero.count);
+	return t.split() / 1000.0;
+}
+
+/*
+ * Every kernel has to agree with the scalar one, on the whole clocks and on
+ * every length up to them (to go through the tails)
+ */
+static bool check(const VectorClockKernels& k, ClockSet& a, ClockSet& b)
+{
+	const VectorClockKernels& s = vectorClockKernelTable[CLOCK_KERNEL_SCALAR];
+	vector<uint32_t> x(a.count), y(a.count);
+
+	for (size_t n = 0; n <= a.count; ++n)
+	{
+		memcpy(&x[0], a.clock(1), a.count * sizeof(uint32_t));
+		memcpy(&y[0], a.clock(1), a.count * sizeof(uint32_t));
+		k.join(&x[0], b.clock(1), n);
+		s.join(&y[0], b.clock(1), n);
+
+		if (memcmp(&x[0], &y[0], a.count * sizeof(uint32_t)) ||
+		        k.equal(a.clock(1), b.clock(1), n) !=
+		        s.equal(a.clock(1), b.clock(1), n) ||
+		        k.lessEqual(a.clock(1), &x[0], n) != true ||
+		        k.lessEqual(&x[0], a.clock(1), n) !=
+		        s.lessEqual(&x[0], a.clock(1), n) ||
+		        k.isZero(a.clock(1), n) != s.isZero(a.clock(1), n))
+		{
+			cout << k.name << " differs from scalar at " << n << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int params, char ** args)
+{
+	uint32_t repeat = params >= 2 ? atoi(args[1]) : 20000;
+	uint64_t answer = 0;
+	bool same = true;
+	ZRandom zr;
+	size_t counts[] = { 32, 64, 67, 256 };
+
+	cout << "# " << PAIR_COUNT << " clock pairs, repeating each run " << repeat
+	     << " times, seconds" << endl;
+	cout << "# components kernel join equal lessequal iszero" << endl;
+
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+	{
+		for (int type = 0; type < CLOCK_KERNEL_COUNT; ++type)
+		{
+			if (!isClockKernelSupported((ClockKernelType) type))
+			{
+				continue;
+			}
+			const VectorClockKernels& k = vectorClockKernelTable[type];
+
+			ClockSet a(counts[c], zr), b(counts[c], zr);
+			ClockSet zero(counts[c], zr);
+			memset(&zero.values[0], 0, zero.values.size() * sizeof(uint32_t));
+			same = same && check(k, a, b);
+
+			double join = testJoin(k, a, b, repeat, answer);
+			double equal = testEqual(k, a, repeat, answer);
+			double lessEqual = testLessEqual(k, a, b, repeat, answer);
+			double isZero = testIsZero(k, zero, repeat, answer);
+			cout << counts[c] << " " << k.name << " " << join << " " << equal
+			     << " " << lessEqual << " " << isZero << endl;
+		}
+		cout << endl;
+	}
+
+	if (!same)
+	{
+		cout << "kernels gave different results" << endl;
+	}
+	return same && answer ? 0 : 1;
+}